@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "arena.h"
+
+namespace AST {
+    std::vector <std::unique_ptr <Arena>> arenas;
+    std::mutex arenas_mutex;
+    thread_local Arena *local_arena = nullptr;
+
+    Arena::Arena() {
+        nodes = 0;
+        node_bytes = 0;
+        used_bytes = 0;
+        reserved_bytes = 0;
+        current = nullptr;
+        end = nullptr;
+    }
+
+    Arena::~Arena() {
+        Clear();
+    }
+
+    void *Arena::Allocate(size_t size, size_t align) {
+        size_t padding = (align - (size_t)current % align) % align;
+        if (!current || (size_t)(end - current) < padding + size) {
+            size_t capacity = std::max(chunk_size, size + align);
+            chunks.push_back(new char[capacity]);
+            current = chunks.back();
+            end = current + capacity;
+            reserved_bytes += capacity;
+            padding = (align - (size_t)current % align) % align;
+        }
+        char *result = current + padding;
+        current = result + size;
+        used_bytes += padding + size;
+        return result;
+    }
+
+    void Arena::Clear() {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); it++) {
+            it->second(it->first);
+        }
+        destructors.clear();
+        for (char *chunk : chunks) {
+            delete[] chunk;
+        }
+        chunks.clear();
+        current = nullptr;
+        end = nullptr;
+        nodes = 0;
+        node_bytes = 0;
+        used_bytes = 0;
+        reserved_bytes = 0;
+    }
+
+    Arena &Arena::Local() {
+        if (!local_arena) {
+            std::lock_guard <std::mutex> lock(arenas_mutex);
+            arenas.push_back(std::make_unique <Arena> ());
+            local_arena = arenas.back().get();
+        }
+        return *local_arena;
+    }
+
+    void FreeNodes() {
+        std::lock_guard <std::mutex> lock(arenas_mutex);
+        for (std::unique_ptr <Arena> &arena : arenas) {
+            arena->Clear();
+        }
+    }
+
+    void PrintMemory() {
+        std::lock_guard <std::mutex> lock(arenas_mutex);
+        size_t nodes = 0, node_bytes = 0, used_bytes = 0, reserved_bytes = 0;
+        for (std::unique_ptr <Arena> &arena : arenas) {
+            nodes += arena->nodes;
+            node_bytes += arena->node_bytes;
+            used_bytes += arena->used_bytes;
+            reserved_bytes += arena->reserved_bytes;
+        }
+        std::cout << "AST memory: " << nodes << " nodes, " << node_bytes << " bytes in nodes";
+        if (nodes) {
+            std::cout << " (" << std::fixed << std::setprecision(1) << (double)node_bytes / nodes << " bytes per node)";
+        }
+        std::cout << ", " << used_bytes << " bytes used, " << reserved_bytes << " bytes reserved in " << arenas.size() << " arenas\n";
+    }
+}
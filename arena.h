@@ -0,0 +1,65 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AST {
+    class Node;
+
+    // Bump allocator that owns the AST. Nodes are constructed in place in
+    // large chunks and are never freed one by one; Clear runs the recorded
+    // destructors and releases every chunk at once. Each thread allocates
+    // from its own arena, see Local.
+    class Arena {
+    public:
+        Arena();
+        ~Arena();
+        Arena(const Arena&) = delete;
+        Arena &operator=(const Arena&) = delete;
+
+        template <class T>
+        T *New() {
+            void *memory = Allocate(sizeof(T), alignof(T));
+            T *object = new (memory) T();
+            if (!std::is_trivially_destructible <T>::value) {
+                destructors.push_back({object, [](void *ptr) { static_cast <T*> (ptr)->~T(); }});
+            }
+            if (std::is_base_of <Node, T>::value) {
+                nodes++;
+                node_bytes += sizeof(T);
+            }
+            return object;
+        }
+
+        void Clear();
+
+        static Arena &Local();
+
+        size_t nodes, node_bytes, used_bytes, reserved_bytes;
+
+    private:
+        static constexpr size_t chunk_size = 64 * 1024;
+
+        std::vector <char*> chunks;
+        char *current, *end;
+        std::vector <std::pair <void*, void(*)(void*)>> destructors;
+
+        void *Allocate(size_t size, size_t align);
+    };
+
+    template <class T>
+    T *New() {
+        return Arena::Local().New <T> ();
+    }
+
+    // Destroys every node of every thread. No node may be used afterwards
+    // and no other thread may be allocating.
+    void FreeNodes();
+    void PrintMemory();
+}
+
+#endif // ARENA_H_INCLUDED
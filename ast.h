@@ -4,8 +4,23 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <map>
 #include <memory>
-
+#include <unordered_map>
+#include "arena.h"
+#include "source.h"
+#include "state.h"
+
+// Identifiers, function names and metavariables are stored as symbol ids
+// interned by the lexer, see symbols.h. Nodes are allocated with AST::New
+// and owned by the arena, see arena.h.
+//
+// AST::Resolve, see resolve.h, sets the variable field of a node using a
+// variable to its index among the variables of the enclosing function,
+// arguments first and then locals in definition order, and the function
+// field of a call to the index of the callee among the functions visible
+// there. Both backends keep their stacks in that order, so they read the
+// definition at that index; -1 means they look the name up themselves.
 namespace AST {
 
 class Node;
@@ -36,6 +51,32 @@ class Division;
 class Less;
 class Equal;
 
+enum class Kind : unsigned char {
+    Block,
+    Asm,
+    If,
+    While,
+    FunctionDefinition,
+    Prototype,
+    Definition,
+    Assignment,
+    Movement,
+    MovementString,
+    Assumption,
+    Identifier,
+    Integer,
+    Alloc,
+    Free,
+    FunctionCall,
+    Dereference,
+    Addition,
+    Subtraction,
+    Multiplication,
+    Division,
+    Less,
+    Equal,
+};
+
 enum class Type {
     Int,
     Ptr,
@@ -43,54 +84,108 @@ enum class Type {
 
 class FunctionSignature {
 public:
-    std::vector <std::string> identifiers;
+    std::vector <int> identifiers;
     std::vector <Type> types;
-    std::vector <std::shared_ptr <Expression>> size_in, size_out;
+    std::vector <Expression*> size_in, size_out;
     std::vector <bool> is_const;
 };
 
 class FunctionSignatureEvaluated {
 public:
-    std::vector <std::string> identifiers;
+    std::vector <int> identifiers;
     std::vector <Type> types;
     std::vector <int> size_in, size_out;
     std::vector <bool> is_const;
 };
 
-struct State {
-    std::vector <std::pair <int, int>> heap;
+// States that entered the body of a loop.
+struct LoopHead {
+    StateSet entered;
+    // Widest state that entered so far of each shape, by shape, and the
+    // number of times it grew.
+    std::map <State, std::pair <State, int>> widest;
+};
+
+// Shared by the loops nested in the outermost loop being validated, see
+// While::Validate.
+struct LoopMemo {
+    std::unordered_map <const Node*, LoopHead> heads;
+    // Packet a statement found in a slot in every state, by statement and
+    // slot, so later iterations check their states against it.
+    std::map <std::pair <const Node*, int>, int> packets;
+    // Packet alignSlot moved a slot to, by statement and slot.
+    std::map <std::pair <const Node*, int>, int> targets;
+};
+
+// Function stacks of a context, kept for the functions it hides from a
+// callee.
+struct FunctionScope {
+    std::vector <int> function_stack;
+    std::vector <FunctionSignature*> function_signature_stack;
+    std::vector <FunctionDefinition*> function_pointer_stack;
+};
+
+// A function that is on the stacks of a caller but not visible where the
+// function being validated is defined. Its body is validated with the
+// functions up to it in the scope it was hidden from.
+struct HiddenFunction {
+    std::shared_ptr <const FunctionScope> scope;
+    int index;
+    std::set <FunctionSignatureEvaluated> validated;
 };
 
 struct VLContext {
-    std::vector <std::string> variable_stack;
+    std::vector <int> variable_stack;
+    std::vector <int> variable_slot_stack;
     std::vector <Type> variable_type_stack;
     std::vector <bool> variable_is_const_stack;
-    std::vector <std::string> function_stack;
-    std::vector <std::shared_ptr <FunctionSignature>> function_signature_stack;
+    std::vector <int> function_stack;
+    std::vector <FunctionSignature*> function_signature_stack;
     std::vector <FunctionDefinition*> function_pointer_stack;
     std::vector <std::set <FunctionSignatureEvaluated>> function_signature_validated;
+    // Functions on the stacks of the callers that the function being
+    // validated does not see where it is defined, most recent last. Calls
+    // left unresolved still find them by name.
+    std::vector <HiddenFunction> hidden_functions;
     std::vector <int> packet_size;
-    std::set <State> states;
-    std::vector <std::pair <std::string, int>> metavariable_stack;
+    StateSet states;
+    std::vector <std::pair <int, int>> metavariable_stack;
+    LoopMemo *loop = nullptr;
+    // Metavariables are bound to themselves and values are linear in them,
+    // see linear.h.
+    bool symbolic = false;
+    // Id of the metavariable values and symbolic, which the validator
+    // caches evaluated expressions by.
+    int binding = 0;
 };
 
 struct CPContext {
-    std::vector <std::string> variable_stack;
+    std::vector <int> variable_stack;
     std::vector <Type> variable_stack_type;
-    std::vector <std::string> variable_arguments;
+    std::vector <int> variable_arguments;
     std::vector <Type> variable_arguments_type;
-    std::vector <std::pair <std::string, int>> function_stack;
+    // Arguments of the function being compiled, after its metavariables in
+    // variable_arguments.
+    int argument_count = 0;
+    std::vector <std::pair <int, int>> function_stack;
     int function_index = 0;
     int branch_index = 0;
 };
 
+// Nodes are not polymorphic: every concrete class stores its Kind tag and
+// Validate/Compile on a Node dispatch on it through Visit to the member of
+// the same name in the concrete class.
 class Node {
 public:
-    virtual ~Node(){};
-    virtual void Validate(VLContext &context) = 0;
-    virtual void Compile(std::ostream &out, CPContext &context) = 0;
-    int line_begin, position_begin, line_end, position_end;
-    std::string filename;
+    Kind kind;
+    void Validate(VLContext &context);
+    void Compile(std::ostream &out, CPContext &context);
+    int line_begin = 0, position_begin = 0, line_end = 0, position_end = 0;
+    int file = 0;
+
+    const std::string &Filename() const {
+        return Source::GetFile(file).filename;
+    }
 };
 
 class Statement : public Node {
@@ -98,13 +193,21 @@ class Statement : public Node {
 
 class Block : public Statement {
 public:
-    std::vector <std::shared_ptr <Statement>> statement_list;
+    static constexpr Kind Tag = Kind::Block;
+    Block() {
+        kind = Tag;
+    }
+    std::vector <Statement*> statement_list;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Asm : public Statement {
 public:
+    static constexpr Kind Tag = Kind::Asm;
+    Asm() {
+        kind = Tag;
+    }
     std::string code;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
@@ -112,67 +215,116 @@ public:
 
 class If : public Statement {
 public:
-    std::vector <std::pair <std::shared_ptr <Expression>, std::shared_ptr<Block>>> branch_list;
-    std::shared_ptr <Block> else_body;
+    static constexpr Kind Tag = Kind::If;
+    If() {
+        kind = Tag;
+    }
+    std::vector <std::pair <Expression*, Block*>> branch_list;
+    Block *else_body = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
+// Clause of a loop invariant: pointer identifier is null, or, if low is
+// set, points into the packet of pointer base at an offset from low to high
+// past the offset of base.
+struct InvariantClause {
+    int identifier = 0;
+    int base = 0;
+    Expression *low = nullptr, *high = nullptr;
+};
+
 class While : public Statement {
 public:
-    std::shared_ptr <Expression> expression;
-    std::shared_ptr <Block> block;
+    static constexpr Kind Tag = Kind::While;
+    While() {
+        kind = Tag;
+    }
+    Expression *expression = nullptr;
+    Block *block = nullptr;
+    // With an invariant the body is validated once, from the states the
+    // invariant allows at the loop head. Pointers it does not mention have
+    // to keep their values.
+    bool has_invariant = false;
+    std::vector <InvariantClause> invariant;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class FunctionDefinition : public Statement {
 public:
-    std::string name;
-    std::vector <std::string> metavariables;
-    std::shared_ptr <FunctionSignature> signature;
-    std::shared_ptr <Block> body;
-    bool external;
+    static constexpr Kind Tag = Kind::FunctionDefinition;
+    FunctionDefinition() {
+        kind = Tag;
+    }
+    int name = 0;
+    std::vector <int> metavariables;
+    FunctionSignature *signature = nullptr;
+    Block *body = nullptr;
+    bool external = false;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Prototype : public Statement {
 public:
-    std::string name;
-    std::vector <std::string> metavariables;
-    std::shared_ptr <FunctionSignature> signature;
+    static constexpr Kind Tag = Kind::Prototype;
+    Prototype() {
+        kind = Tag;
+    }
+    int name = 0;
+    std::vector <int> metavariables;
+    FunctionSignature *signature = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Definition : public Statement {
 public:
-    std::string identifier;
-    Type type;
+    static constexpr Kind Tag = Kind::Definition;
+    Definition() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    Type type = Type::Int;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Assignment : public Statement {
 public:
-    std::string identifier;
-    std::shared_ptr <Expression> value;
+    static constexpr Kind Tag = Kind::Assignment;
+    Assignment() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    int variable = -1;
+    Expression *value = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Movement : public Statement {
 public:
-    std::string identifier;
-    std::shared_ptr <Expression> value;
+    static constexpr Kind Tag = Kind::Movement;
+    Movement() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    int variable = -1;
+    Expression *value = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class MovementString : public Statement {
 public:
-    std::string identifier;
+    static constexpr Kind Tag = Kind::MovementString;
+    MovementString() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    int variable = -1;
     std::string value;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
@@ -180,102 +332,232 @@ public:
 
 class Assumption : public Statement {
 public:
-    std::string identifier;
-    std::shared_ptr <Expression> left, right;
-    std::shared_ptr <Statement> statement;
+    static constexpr Kind Tag = Kind::Assumption;
+    Assumption() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    int variable = -1;
+    Expression *left = nullptr, *right = nullptr;
+    Statement *statement = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Expression : public Node {
+public:
+    // Set by AST::Resolve on expressions of integers only whose value and
+    // the values of their parts stay inside the offset range, where the
+    // validator evaluates them the same way for concrete and symbolic
+    // metavariables.
+    bool folded = false;
+    int folded_value = 0;
 };
 
 class Identifier : public Expression {
 public:
-    std::string identifier;
+    static constexpr Kind Tag = Kind::Identifier;
+    Identifier() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    int variable = -1;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Integer : public Expression {
 public:
-    int value;
+    static constexpr Kind Tag = Kind::Integer;
+    Integer() {
+        kind = Tag;
+    }
+    int value = 0;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Alloc : public Expression {
 public:
-    std::shared_ptr <Expression> expression;
+    static constexpr Kind Tag = Kind::Alloc;
+    Alloc() {
+        kind = Tag;
+    }
+    Expression *expression = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Free : public Statement {
 public:
-    std::shared_ptr <Expression> arg;
+    static constexpr Kind Tag = Kind::Free;
+    Free() {
+        kind = Tag;
+    }
+    Expression *arg = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class FunctionCall : public Statement {
 public:
-    std::string identifier;
-    std::vector <std::pair <std::string, std::shared_ptr <Expression>>> metavariables;
-    std::vector <std::string> arguments;
+    static constexpr Kind Tag = Kind::FunctionCall;
+    FunctionCall() {
+        kind = Tag;
+    }
+    int identifier = 0;
+    std::vector <std::pair <int, Expression*>> metavariables;
+    std::vector <int> arguments;
+    int function = -1;
+    std::vector <int> argument_variables;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Dereference : public Expression {
 public:
-    std::shared_ptr <Expression> arg;
+    static constexpr Kind Tag = Kind::Dereference;
+    Dereference() {
+        kind = Tag;
+    }
+    Expression *arg = nullptr;
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class BinaryOperation : public Expression {
 public:
-    std::shared_ptr <Expression> left, right;
-    virtual ~BinaryOperation() {}
+    Expression *left = nullptr, *right = nullptr;
 };
 
 class Addition : public BinaryOperation {
 public:
+    static constexpr Kind Tag = Kind::Addition;
+    Addition() {
+        kind = Tag;
+    }
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Subtraction : public BinaryOperation {
 public:
+    static constexpr Kind Tag = Kind::Subtraction;
+    Subtraction() {
+        kind = Tag;
+    }
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Multiplication : public BinaryOperation {
 public:
+    static constexpr Kind Tag = Kind::Multiplication;
+    Multiplication() {
+        kind = Tag;
+    }
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Division : public BinaryOperation {
 public:
+    static constexpr Kind Tag = Kind::Division;
+    Division() {
+        kind = Tag;
+    }
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Less : public BinaryOperation {
 public:
+    static constexpr Kind Tag = Kind::Less;
+    Less() {
+        kind = Tag;
+    }
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
 class Equal : public BinaryOperation {
 public:
+    static constexpr Kind Tag = Kind::Equal;
+    Equal() {
+        kind = Tag;
+    }
     void Validate(VLContext &context);
     void Compile(std::ostream &out, CPContext &context);
 };
 
+// Returns node as a T when it is of kind T::Tag, nullptr otherwise.
+template <class T>
+T *As(Node *node) {
+    return (node && node->kind == T::Tag ? static_cast <T*> (node) : nullptr);
+}
+
+// Calls visitor with node cast to its concrete class.
+template <class Visitor>
+decltype(auto) Visit(Node *node, Visitor &&visitor) {
+    switch (node->kind) {
+    case Kind::Block:
+        return visitor(static_cast <Block*> (node));
+    case Kind::Asm:
+        return visitor(static_cast <Asm*> (node));
+    case Kind::If:
+        return visitor(static_cast <If*> (node));
+    case Kind::While:
+        return visitor(static_cast <While*> (node));
+    case Kind::FunctionDefinition:
+        return visitor(static_cast <FunctionDefinition*> (node));
+    case Kind::Prototype:
+        return visitor(static_cast <Prototype*> (node));
+    case Kind::Definition:
+        return visitor(static_cast <Definition*> (node));
+    case Kind::Assignment:
+        return visitor(static_cast <Assignment*> (node));
+    case Kind::Movement:
+        return visitor(static_cast <Movement*> (node));
+    case Kind::MovementString:
+        return visitor(static_cast <MovementString*> (node));
+    case Kind::Assumption:
+        return visitor(static_cast <Assumption*> (node));
+    case Kind::Identifier:
+        return visitor(static_cast <Identifier*> (node));
+    case Kind::Integer:
+        return visitor(static_cast <Integer*> (node));
+    case Kind::Alloc:
+        return visitor(static_cast <Alloc*> (node));
+    case Kind::Free:
+        return visitor(static_cast <Free*> (node));
+    case Kind::FunctionCall:
+        return visitor(static_cast <FunctionCall*> (node));
+    case Kind::Dereference:
+        return visitor(static_cast <Dereference*> (node));
+    case Kind::Addition:
+        return visitor(static_cast <Addition*> (node));
+    case Kind::Subtraction:
+        return visitor(static_cast <Subtraction*> (node));
+    case Kind::Multiplication:
+        return visitor(static_cast <Multiplication*> (node));
+    case Kind::Division:
+        return visitor(static_cast <Division*> (node));
+    case Kind::Less:
+        return visitor(static_cast <Less*> (node));
+    case Kind::Equal:
+        return visitor(static_cast <Equal*> (node));
+    }
+    __builtin_unreachable();
+}
+
+inline void Node::Validate(VLContext &context) {
+    Visit(this, [&context](auto *node) { node->Validate(context); });
+}
+
+inline void Node::Compile(std::ostream &out, CPContext &context) {
+    Visit(this, [&out, &context](auto *node) { node->Compile(out, context); });
+}
+
 }
 
 #endif // AST_H_INCLUDED
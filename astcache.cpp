@@ -0,0 +1,749 @@
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astcache.h"
+#include "settings.h"
+#include "source.h"
+#include "symbols.h"
+
+namespace ASTCache {
+    const char magic[8] = {'A', 'L', 'A', 'S', 'T', 0, 0, 0};
+    const char summary_magic[8] = {'A', 'L', 'S', 'U', 'M', 0, 0, 0};
+    const uint32_t format_version = 2;
+    const char build_stamp[] = __VERSION__ " " __DATE__ " " __TIME__;
+    const unsigned char null_kind = 0xFF;
+
+    std::atomic <int> loaded(0);
+    std::atomic <int> missed(0);
+    std::atomic <int> stored(0);
+    std::atomic <int> summaries_found(0);
+    std::atomic <int> summaries_missed(0);
+    std::atomic <int> summaries_stored(0);
+
+    uint64_t Hash(std::string_view text) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : text) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string EntryPath(uint64_t hash, const char *extension = "ast") {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.%s", (unsigned long long)hash, extension);
+        return Settings::GetCacheDirectory() + "/" + name;
+    }
+
+    // Written under a unique name and renamed into place, so concurrent
+    // compilations never see a partial entry.
+    bool WriteEntry(const std::string &path, const std::string &data) {
+        mkdir(Settings::GetCacheDirectory().c_str(), 0777);
+        std::string temporary = path + "." + std::to_string(getpid()) + "." +
+                                std::to_string(std::hash <std::thread::id> ()(std::this_thread::get_id())) + ".tmp";
+        std::ofstream out(temporary, std::ios::binary);
+        out << data;
+        out.close();
+        if (!out || rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool IsExpression(AST::Kind kind) {
+        switch (kind) {
+        case AST::Kind::Identifier:
+        case AST::Kind::Integer:
+        case AST::Kind::Alloc:
+        case AST::Kind::Dereference:
+        case AST::Kind::Addition:
+        case AST::Kind::Subtraction:
+        case AST::Kind::Multiplication:
+        case AST::Kind::Division:
+        case AST::Kind::Less:
+        case AST::Kind::Equal:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    class Writer {
+    public:
+        std::string data;
+        std::vector <int> symbols;
+        std::unordered_map <int, uint32_t> symbol_index;
+        std::unordered_map <AST::Block*, uint32_t> block_index;
+
+        void U8(unsigned char value) {
+            data.push_back((char)value);
+        }
+
+        // Integers are stored as LEB128 varints, signed ones zigzag encoded;
+        // positions and symbol indices mostly take a single byte.
+        void U32(uint32_t value) {
+            while (value >= 0x80) {
+                data.push_back((char)(value | 0x80));
+                value >>= 7;
+            }
+            data.push_back((char)value);
+        }
+
+        void I32(int32_t value) {
+            U32(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+        }
+
+        void String(const std::string &value) {
+            U32((uint32_t)value.size());
+            data.append(value);
+        }
+
+        void Symbol(int id) {
+            auto it = symbol_index.find(id);
+            if (it == symbol_index.end()) {
+                it = symbol_index.insert({id, (uint32_t)symbols.size()}).first;
+                symbols.push_back(id);
+            }
+            U32(it->second);
+        }
+
+        void Symbols(const std::vector <int> &ids) {
+            U32((uint32_t)ids.size());
+            for (int id : ids) {
+                Symbol(id);
+            }
+        }
+
+        void Signature(AST::FunctionSignature *signature) {
+            U8(signature != nullptr);
+            if (!signature) {
+                return;
+            }
+            Symbols(signature->identifiers);
+            U32((uint32_t)signature->types.size());
+            for (AST::Type type : signature->types) {
+                U8((unsigned char)type);
+            }
+            U32((uint32_t)signature->size_in.size());
+            for (AST::Expression *expression : signature->size_in) {
+                Node(expression);
+            }
+            U32((uint32_t)signature->size_out.size());
+            for (AST::Expression *expression : signature->size_out) {
+                Node(expression);
+            }
+            U32((uint32_t)signature->is_const.size());
+            for (bool is_const : signature->is_const) {
+                U8(is_const);
+            }
+        }
+
+        void Node(AST::Node *node) {
+            if (!node) {
+                U8(null_kind);
+                return;
+            }
+            U8((unsigned char)node->kind);
+            I32(node->line_begin);
+            I32(node->position_begin);
+            I32(node->line_end);
+            I32(node->position_end);
+            switch (node->kind) {
+            case AST::Kind::Block: {
+                AST::Block *block = static_cast <AST::Block*> (node);
+                block_index[block] = (uint32_t)block_index.size();
+                U32((uint32_t)block->statement_list.size());
+                for (AST::Statement *statement : block->statement_list) {
+                    Node(statement);
+                }
+                break;
+            }
+            case AST::Kind::Asm:
+                String(static_cast <AST::Asm*> (node)->code);
+                break;
+            case AST::Kind::If: {
+                AST::If *_if = static_cast <AST::If*> (node);
+                U32((uint32_t)_if->branch_list.size());
+                for (auto &branch : _if->branch_list) {
+                    Node(branch.first);
+                    Node(branch.second);
+                }
+                Node(_if->else_body);
+                break;
+            }
+            case AST::Kind::While: {
+                AST::While *_while = static_cast <AST::While*> (node);
+                Node(_while->expression);
+                Node(_while->block);
+                U8(_while->has_invariant);
+                U32((uint32_t)_while->invariant.size());
+                for (const AST::InvariantClause &clause : _while->invariant) {
+                    Symbol(clause.identifier);
+                    U8(clause.low != nullptr);
+                    if (clause.low) {
+                        Symbol(clause.base);
+                        Node(clause.low);
+                        Node(clause.high);
+                    }
+                }
+                break;
+            }
+            case AST::Kind::FunctionDefinition: {
+                AST::FunctionDefinition *function = static_cast <AST::FunctionDefinition*> (node);
+                Symbol(function->name);
+                Symbols(function->metavariables);
+                Signature(function->signature);
+                Node(function->body);
+                U8(function->external);
+                break;
+            }
+            case AST::Kind::Prototype: {
+                AST::Prototype *prototype = static_cast <AST::Prototype*> (node);
+                Symbol(prototype->name);
+                Symbols(prototype->metavariables);
+                Signature(prototype->signature);
+                break;
+            }
+            case AST::Kind::Definition: {
+                AST::Definition *definition = static_cast <AST::Definition*> (node);
+                Symbol(definition->identifier);
+                U8((unsigned char)definition->type);
+                break;
+            }
+            case AST::Kind::Assignment: {
+                AST::Assignment *assignment = static_cast <AST::Assignment*> (node);
+                Symbol(assignment->identifier);
+                Node(assignment->value);
+                break;
+            }
+            case AST::Kind::Movement: {
+                AST::Movement *movement = static_cast <AST::Movement*> (node);
+                Symbol(movement->identifier);
+                Node(movement->value);
+                break;
+            }
+            case AST::Kind::MovementString: {
+                AST::MovementString *movement_string = static_cast <AST::MovementString*> (node);
+                Symbol(movement_string->identifier);
+                String(movement_string->value);
+                break;
+            }
+            case AST::Kind::Assumption: {
+                AST::Assumption *assumption = static_cast <AST::Assumption*> (node);
+                Symbol(assumption->identifier);
+                Node(assumption->left);
+                Node(assumption->right);
+                Node(assumption->statement);
+                break;
+            }
+            case AST::Kind::Identifier:
+                Symbol(static_cast <AST::Identifier*> (node)->identifier);
+                break;
+            case AST::Kind::Integer:
+                I32(static_cast <AST::Integer*> (node)->value);
+                break;
+            case AST::Kind::Alloc:
+                Node(static_cast <AST::Alloc*> (node)->expression);
+                break;
+            case AST::Kind::Free:
+                Node(static_cast <AST::Free*> (node)->arg);
+                break;
+            case AST::Kind::FunctionCall: {
+                AST::FunctionCall *function_call = static_cast <AST::FunctionCall*> (node);
+                Symbol(function_call->identifier);
+                U32((uint32_t)function_call->metavariables.size());
+                for (auto &metavariable : function_call->metavariables) {
+                    Symbol(metavariable.first);
+                    Node(metavariable.second);
+                }
+                Symbols(function_call->arguments);
+                break;
+            }
+            case AST::Kind::Dereference:
+                Node(static_cast <AST::Dereference*> (node)->arg);
+                break;
+            default: {
+                AST::BinaryOperation *operation = static_cast <AST::BinaryOperation*> (node);
+                Node(operation->left);
+                Node(operation->right);
+                break;
+            }
+            }
+        }
+    };
+
+    class Reader {
+    public:
+        const char *cursor, *end;
+        bool ok;
+        int file;
+        std::vector <int> symbols;
+        std::vector <AST::Block*> blocks;
+
+        Reader(std::string_view data) {
+            cursor = data.data();
+            end = data.data() + data.size();
+            ok = true;
+            file = 0;
+        }
+
+        bool Read(void *value, size_t size) {
+            if (!ok || (size_t)(end - cursor) < size) {
+                ok = false;
+                memset(value, 0, size);
+                return false;
+            }
+            memcpy(value, cursor, size);
+            cursor += size;
+            return true;
+        }
+
+        unsigned char U8() {
+            unsigned char value;
+            Read(&value, sizeof(value));
+            return value;
+        }
+
+        uint32_t U32() {
+            uint32_t value = 0;
+            for (int shift = 0; shift < 35; shift += 7) {
+                if (cursor == end) {
+                    ok = false;
+                    return 0;
+                }
+                unsigned char byte = (unsigned char)*cursor++;
+                value |= (uint32_t)(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    return value;
+                }
+            }
+            ok = false;
+            return 0;
+        }
+
+        int32_t I32() {
+            uint32_t value = U32();
+            return (int32_t)((value >> 1) ^ (~(value & 1) + 1));
+        }
+
+        // Element counts are bounded by the remaining input so that a damaged
+        // entry cannot request a huge allocation.
+        uint32_t Count() {
+            uint32_t count = U32();
+            if (count > (size_t)(end - cursor)) {
+                ok = false;
+                return 0;
+            }
+            return count;
+        }
+
+        std::string String() {
+            uint32_t size = Count();
+            if (!ok) {
+                return std::string();
+            }
+            std::string value(cursor, size);
+            cursor += size;
+            return value;
+        }
+
+        int Symbol() {
+            uint32_t index = U32();
+            if (index >= symbols.size()) {
+                ok = false;
+                return 0;
+            }
+            return symbols[index];
+        }
+
+        std::vector <int> Symbols() {
+            std::vector <int> ids(Count());
+            for (int &id : ids) {
+                id = Symbol();
+            }
+            return ids;
+        }
+
+        AST::FunctionSignature *Signature() {
+            if (!U8()) {
+                return nullptr;
+            }
+            AST::FunctionSignature *signature = AST::New <AST::FunctionSignature> ();
+            signature->identifiers = Symbols();
+            signature->types.resize(Count());
+            for (AST::Type &type : signature->types) {
+                type = (AST::Type)U8();
+            }
+            signature->size_in.resize(Count());
+            for (AST::Expression *&expression : signature->size_in) {
+                expression = Expression();
+            }
+            signature->size_out.resize(Count());
+            for (AST::Expression *&expression : signature->size_out) {
+                expression = Expression();
+            }
+            uint32_t count = Count();
+            for (uint32_t i = 0; i < count; i++) {
+                signature->is_const.push_back(U8());
+            }
+            return signature;
+        }
+
+        AST::Expression *Expression() {
+            AST::Node *node = Node();
+            if (node && !IsExpression(node->kind)) {
+                ok = false;
+                return nullptr;
+            }
+            return static_cast <AST::Expression*> (node);
+        }
+
+        AST::Statement *Statement() {
+            AST::Node *node = Node();
+            if (node && IsExpression(node->kind)) {
+                ok = false;
+                return nullptr;
+            }
+            return static_cast <AST::Statement*> (node);
+        }
+
+        AST::Block *Block() {
+            AST::Node *node = Node();
+            if (node && node->kind != AST::Kind::Block) {
+                ok = false;
+                return nullptr;
+            }
+            return static_cast <AST::Block*> (node);
+        }
+
+        template <class T>
+        T *Make() {
+            T *node = AST::New <T> ();
+            node->line_begin = I32();
+            node->position_begin = I32();
+            node->line_end = I32();
+            node->position_end = I32();
+            node->file = file;
+            return node;
+        }
+
+        template <class T>
+        AST::Node *Binary() {
+            T *operation = Make <T> ();
+            operation->left = Expression();
+            operation->right = Expression();
+            return operation;
+        }
+
+        AST::Node *Node() {
+            unsigned char kind = U8();
+            if (!ok || kind == null_kind) {
+                return nullptr;
+            }
+            switch ((AST::Kind)kind) {
+            case AST::Kind::Block: {
+                AST::Block *block = Make <AST::Block> ();
+                blocks.push_back(block);
+                uint32_t count = Count();
+                for (uint32_t i = 0; i < count && ok; i++) {
+                    block->statement_list.push_back(Statement());
+                }
+                return block;
+            }
+            case AST::Kind::Asm: {
+                AST::Asm *_asm = Make <AST::Asm> ();
+                _asm->code = String();
+                return _asm;
+            }
+            case AST::Kind::If: {
+                AST::If *_if = Make <AST::If> ();
+                uint32_t count = Count();
+                for (uint32_t i = 0; i < count && ok; i++) {
+                    AST::Expression *expression = Expression();
+                    _if->branch_list.push_back({expression, Block()});
+                }
+                _if->else_body = Block();
+                return _if;
+            }
+            case AST::Kind::While: {
+                AST::While *_while = Make <AST::While> ();
+                _while->expression = Expression();
+                _while->block = Block();
+                _while->has_invariant = U8();
+                uint32_t count = Count();
+                for (uint32_t i = 0; i < count && ok; i++) {
+                    AST::InvariantClause clause;
+                    clause.identifier = Symbol();
+                    if (U8()) {
+                        clause.base = Symbol();
+                        clause.low = Expression();
+                        clause.high = Expression();
+                    }
+                    _while->invariant.push_back(clause);
+                }
+                return _while;
+            }
+            case AST::Kind::FunctionDefinition: {
+                AST::FunctionDefinition *function = Make <AST::FunctionDefinition> ();
+                function->name = Symbol();
+                function->metavariables = Symbols();
+                function->signature = Signature();
+                function->body = Block();
+                function->external = U8();
+                return function;
+            }
+            case AST::Kind::Prototype: {
+                AST::Prototype *prototype = Make <AST::Prototype> ();
+                prototype->name = Symbol();
+                prototype->metavariables = Symbols();
+                prototype->signature = Signature();
+                return prototype;
+            }
+            case AST::Kind::Definition: {
+                AST::Definition *definition = Make <AST::Definition> ();
+                definition->identifier = Symbol();
+                definition->type = (AST::Type)U8();
+                return definition;
+            }
+            case AST::Kind::Assignment: {
+                AST::Assignment *assignment = Make <AST::Assignment> ();
+                assignment->identifier = Symbol();
+                assignment->value = Expression();
+                return assignment;
+            }
+            case AST::Kind::Movement: {
+                AST::Movement *movement = Make <AST::Movement> ();
+                movement->identifier = Symbol();
+                movement->value = Expression();
+                return movement;
+            }
+            case AST::Kind::MovementString: {
+                AST::MovementString *movement_string = Make <AST::MovementString> ();
+                movement_string->identifier = Symbol();
+                movement_string->value = String();
+                return movement_string;
+            }
+            case AST::Kind::Assumption: {
+                AST::Assumption *assumption = Make <AST::Assumption> ();
+                assumption->identifier = Symbol();
+                assumption->left = Expression();
+                assumption->right = Expression();
+                assumption->statement = Statement();
+                return assumption;
+            }
+            case AST::Kind::Identifier: {
+                AST::Identifier *identifier = Make <AST::Identifier> ();
+                identifier->identifier = Symbol();
+                return identifier;
+            }
+            case AST::Kind::Integer: {
+                AST::Integer *integer = Make <AST::Integer> ();
+                integer->value = I32();
+                return integer;
+            }
+            case AST::Kind::Alloc: {
+                AST::Alloc *alloc = Make <AST::Alloc> ();
+                alloc->expression = Expression();
+                return alloc;
+            }
+            case AST::Kind::Free: {
+                AST::Free *_free = Make <AST::Free> ();
+                _free->arg = Expression();
+                return _free;
+            }
+            case AST::Kind::FunctionCall: {
+                AST::FunctionCall *function_call = Make <AST::FunctionCall> ();
+                function_call->identifier = Symbol();
+                uint32_t count = Count();
+                for (uint32_t i = 0; i < count && ok; i++) {
+                    int metavariable = Symbol();
+                    function_call->metavariables.push_back({metavariable, Expression()});
+                }
+                function_call->arguments = Symbols();
+                return function_call;
+            }
+            case AST::Kind::Dereference: {
+                AST::Dereference *dereference = Make <AST::Dereference> ();
+                dereference->arg = Expression();
+                return dereference;
+            }
+            case AST::Kind::Addition:
+                return Binary <AST::Addition> ();
+            case AST::Kind::Subtraction:
+                return Binary <AST::Subtraction> ();
+            case AST::Kind::Multiplication:
+                return Binary <AST::Multiplication> ();
+            case AST::Kind::Division:
+                return Binary <AST::Division> ();
+            case AST::Kind::Less:
+                return Binary <AST::Less> ();
+            case AST::Kind::Equal:
+                return Binary <AST::Equal> ();
+            }
+            ok = false;
+            return nullptr;
+        }
+    };
+
+    bool Load(std::string filename, uint64_t hash, AST::Node *&node, std::vector <Syntax::Splice> &splices) {
+        Source::Buffer buffer(EntryPath(hash));
+        if (!buffer.Good()) {
+            missed++;
+            return false;
+        }
+        Reader reader(buffer.View());
+        char header[sizeof(magic)];
+        reader.Read(header, sizeof(header));
+        uint32_t version = reader.U32();
+        std::string stamp = reader.String();
+        uint64_t entry_hash = 0, checksum = 0;
+        reader.Read(&entry_hash, sizeof(entry_hash));
+        reader.Read(&checksum, sizeof(checksum));
+        if (!reader.ok || memcmp(header, magic, sizeof(magic)) || version != format_version ||
+            stamp != build_stamp || entry_hash != hash ||
+            checksum != Hash(std::string_view(reader.cursor, reader.end - reader.cursor))) {
+            missed++;
+            return false;
+        }
+
+        std::vector <unsigned int> lines(reader.Count());
+        for (unsigned int &line : lines) {
+            line = reader.U32();
+        }
+        uint32_t symbol_count = reader.Count();
+        for (uint32_t i = 0; i < symbol_count && reader.ok; i++) {
+            reader.symbols.push_back(Symbols::Intern(reader.String()));
+        }
+        if (!reader.ok || lines.empty()) {
+            missed++;
+            return false;
+        }
+
+        reader.file = Source::AddFile(filename);
+        Source::GetFile(reader.file).lines = lines;
+        AST::Node *_node = reader.Block();
+        std::vector <Syntax::Splice> _splices;
+        uint32_t splice_count = reader.Count();
+        for (uint32_t i = 0; i < splice_count && reader.ok; i++) {
+            uint32_t block = reader.U32();
+            uint32_t index = reader.U32();
+            int value = reader.Symbol();
+            unsigned int begin = reader.U32();
+            unsigned int end = reader.U32();
+            if (block >= reader.blocks.size() || index > reader.blocks[block]->statement_list.size()) {
+                reader.ok = false;
+                break;
+            }
+            _splices.push_back({reader.blocks[block], index, Token(TokenType::Include, value, reader.file, begin, end)});
+        }
+        if (!reader.ok || !_node || reader.cursor != reader.end) {
+            missed++;
+            return false;
+        }
+        node = _node;
+        splices = std::move(_splices);
+        loaded++;
+        return true;
+    }
+
+    void Store(uint64_t hash, int file, AST::Node *node, const std::vector <Syntax::Splice> &splices) {
+        Writer tree;
+        tree.Node(node);
+        Writer tail;
+        tail.symbol_index = std::move(tree.symbol_index);
+        tail.symbols = std::move(tree.symbols);
+        tail.U32((uint32_t)splices.size());
+        for (const Syntax::Splice &splice : splices) {
+            tail.U32(tree.block_index.at(splice.block));
+            tail.U32((uint32_t)splice.index);
+            tail.Symbol(splice.token.value);
+            tail.U32(splice.token.begin);
+            tail.U32(splice.token.end);
+        }
+
+        Writer body;
+        const std::vector <unsigned int> &lines = Source::GetFile(file).lines;
+        body.U32((uint32_t)lines.size());
+        for (unsigned int line : lines) {
+            body.U32(line);
+        }
+        body.U32((uint32_t)tail.symbols.size());
+        for (int id : tail.symbols) {
+            body.String(Symbols::Get(id));
+        }
+        body.data += tree.data;
+        body.data += tail.data;
+
+        Writer head;
+        head.data.append(magic, sizeof(magic));
+        head.U32(format_version);
+        head.String(build_stamp);
+        uint64_t checksum = Hash(body.data);
+        head.data.append((const char*)&hash, sizeof(hash));
+        head.data.append((const char*)&checksum, sizeof(checksum));
+
+        if (WriteEntry(EntryPath(hash), head.data + body.data)) {
+            stored++;
+        }
+    }
+
+    uint64_t HashNode(AST::Node *node) {
+        Writer writer;
+        writer.Node(node);
+        for (int id : writer.symbols) {
+            writer.String(Symbols::Get(id));
+        }
+        return Hash(writer.data);
+    }
+
+    uint64_t HashSignature(AST::FunctionSignature *signature) {
+        Writer writer;
+        writer.Signature(signature);
+        for (int id : writer.symbols) {
+            writer.String(Symbols::Get(id));
+        }
+        return Hash(writer.data);
+    }
+
+    // A summary entry has no body, its header alone records the key.
+    std::string SummaryHeader(uint64_t key) {
+        Writer head;
+        head.data.append(summary_magic, sizeof(summary_magic));
+        head.U32(format_version);
+        head.String(build_stamp);
+        head.data.append((const char*)&key, sizeof(key));
+        return head.data;
+    }
+
+    bool LoadSummary(uint64_t key) {
+        Source::Buffer buffer(EntryPath(key, "sum"));
+        if (!buffer.Good() || buffer.View() != SummaryHeader(key)) {
+            summaries_missed++;
+            return false;
+        }
+        summaries_found++;
+        return true;
+    }
+
+    void StoreSummary(uint64_t key) {
+        if (WriteEntry(EntryPath(key, "sum"), SummaryHeader(key))) {
+            summaries_stored++;
+        }
+    }
+
+    void PrintStatistics() {
+        std::cout << "AST cache: " << loaded << " loaded, " << missed << " missed, " << stored << " stored\n";
+    }
+
+    void PrintSummaryStatistics() {
+        std::cout << "Summary cache: " << summaries_found << " found, " << summaries_missed << " missed, " << summaries_stored << " stored\n";
+    }
+}
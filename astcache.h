@@ -0,0 +1,37 @@
+#ifndef ASTCACHE_H_INCLUDED
+#define ASTCACHE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "syntax.h"
+
+// Binary cache of parsed files, enabled by the -p flag. An entry holds the
+// tree of one file as produced by Syntax::Process with includes deferred,
+// its include splices, the symbols it uses and its line table. Entries are
+// named by the hash of the source text and carry the format version and the
+// build stamp of the compiler and a checksum of their contents, so a stale
+// or damaged entry is never loaded.
+//
+// The same directory holds summary entries, which record that a function was
+// validated under a key the validator computes from everything the result
+// depends on, see validator.cpp.
+namespace ASTCache {
+    uint64_t Hash(std::string_view text);
+    // Loads the entry of a file with the given text hash and registers the
+    // file under filename. Returns false when there is no valid entry.
+    bool Load(std::string filename, uint64_t hash, AST::Node *&node, std::vector <Syntax::Splice> &splices);
+    void Store(uint64_t hash, int file, AST::Node *node, const std::vector <Syntax::Splice> &splices);
+    void PrintStatistics();
+    // Hashes of a tree and of a signature as they would be stored, symbol
+    // names included.
+    uint64_t HashNode(AST::Node *node);
+    uint64_t HashSignature(AST::FunctionSignature *signature);
+    // Whether a summary entry exists for the key.
+    bool LoadSummary(uint64_t key);
+    void StoreSummary(uint64_t key);
+    void PrintSummaryStatistics();
+}
+
+#endif // ASTCACHE_H_INCLUDED
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Time of a cold parse of a large included file against a load of its
+# cached AST with -p. The size of the file in MB can be given as the only
+# argument. Run from the repository root after building calias.
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+size=${1:-16}
+calias=$(pwd)/calias
+
+python3 - "$dir" "$size" <<'PY'
+import sys
+dir, size = sys.argv[1], float(sys.argv[2]) * 1048576
+with open(dir + "/lib.al", "w") as f:
+    written, i = 0, 0
+    while written < size:
+        n = str(i)
+        function = ("func f" + n + "(p ptr 1 : 0, n int) {\n"
+                    "    def q ptr\n"
+                    "    def count_" + n + " int\n"
+                    "    count_" + n + " := (n + " + n + ") * 3 - n / 2\n"
+                    "    if (count_" + n + " < 10) {\n"
+                    "        q := alloc(2)\n"
+                    "        free(q)\n"
+                    "    }\n"
+                    "    while (count_" + n + ") {\n"
+                    "        count_" + n + " := count_" + n + " - 1\n"
+                    "    }\n"
+                    "    free(p)\n"
+                    "}\n")
+        f.write(function)
+        written += len(function)
+        i += 1
+with open(dir + "/main.al", "w") as f:
+    f.write("include {lib.al}\nfunc ^main() {\n}\n")
+# Stops with a syntax error once the include is parsed or loaded, which
+# leaves out everything after the front end.
+with open(dir + "/front.al", "w") as f:
+    f.write("include {lib.al}\nfunc ^main() {\n    x := +\n}\n")
+PY
+
+# The front end runs fail on purpose, so run ignores the status and main.al
+# is checked once up front, which also warms the page cache.
+run() {
+    start=$(date +%s%N)
+    "$calias" "$@" > /dev/null || true
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+# Includes are found relative to the working directory.
+cd "$dir"
+mkdir cache
+"$calias" main.al
+parse=$(run main.al)
+store=$(run main.al -p cache)
+load=$(run main.al -p cache)
+front_parse=$(run front.al)
+front_load=$(run front.al -p cache)
+echo "astcache: $size MB include, parse $parse ms, parse and store $store ms, load $load ms"
+echo "astcache: front end only, parse $front_parse ms, load $front_load ms"
@@ -0,0 +1,36 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "program.h"
+
+// Lexing throughput of Lexer::Process on a generated program, in MB/s. The
+// size of the program in MB can be given as the only argument.
+
+int main(int argc, char **argv) {
+    size_t size = (argc > 1 ? atof(argv[1]) : 16) * 1048576;
+    std::string program = Generate(size);
+    std::string filename = WriteProgram(program);
+
+    const int runs = 5;
+    double best = 0;
+    size_t tokens = 0;
+    for (int i = 0; i < runs; i++) {
+        Source::Buffer source(filename);
+        auto start = std::chrono::steady_clock::now();
+        std::vector <Token> token_stream = Lexer::Process(source);
+        double seconds = std::chrono::duration <double> (std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+        tokens = token_stream.size();
+    }
+    unlink(filename.c_str());
+
+    printf("lexer: %.1f MB, %zu tokens, best of %d: %.1f ms, %.1f MB/s\n",
+           program.size() / 1048576.0, tokens, runs, best * 1000, program.size() / 1048576.0 / best);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "syntax.h"
+#include "program.h"
+
+// Parsing throughput of Syntax::Process on the tokens of a generated
+// program, about a million of them by default, in tokens per second. The
+// size of the program in MB can be given as the only argument.
+
+int main(int argc, char **argv) {
+    size_t size = (argc > 1 ? atof(argv[1]) : 4.2) * 1048576;
+    std::string program = Generate(size);
+    std::string filename = WriteProgram(program);
+    std::vector <Token> token_stream;
+    {
+        Source::Buffer source(filename);
+        token_stream = Lexer::Process(source);
+    }
+    unlink(filename.c_str());
+
+    const int runs = 5;
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        Syntax::Process(token_stream);
+        double seconds = std::chrono::duration <double> (std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+
+    printf("parse: %zu tokens, best of %d: %.1f ms, %.1f M tokens/s\n",
+           token_stream.size(), runs, best * 1000, token_stream.size() / 1e6 / best);
+    return 0;
+}
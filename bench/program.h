@@ -0,0 +1,48 @@
+#ifndef BENCH_PROGRAM_H_INCLUDED
+#define BENCH_PROGRAM_H_INCLUDED
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+// A valid program of at least size bytes made of small functions, for the
+// benchmarks of the front end.
+inline std::string Generate(size_t size) {
+    std::string program;
+    for (int i = 0; program.size() < size; i++) {
+        std::string n = std::to_string(i);
+        program += "func f" + n + "(p ptr 1 : 0, n int) {\n";
+        program += "    def q ptr\n";
+        program += "    def count_" + n + " int\n";
+        program += "    count_" + n + " := (n + " + n + ") * 3 - n / 2\n";
+        program += "    if (count_" + n + " < 10) {\n";
+        program += "        q := alloc(2)\n";
+        program += "        free(q)\n";
+        program += "    }\n";
+        program += "    while (count_" + n + ") {\n";
+        program += "        count_" + n + " := count_" + n + " - 1\n";
+        program += "    }\n";
+        program += "    asm {nop ; f" + n + "}\n";
+        program += "    free(p)\n";
+        program += "}\n";
+    }
+    return program;
+}
+
+// Writes program to a new temporary file and returns its name, which the
+// caller unlinks.
+inline std::string WriteProgram(const std::string &program) {
+    char filename[] = "/tmp/calias_bench_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    close(fd);
+    std::ofstream(filename) << program;
+    return filename;
+}
+
+#endif // BENCH_PROGRAM_H_INCLUDED
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <vector>
+
+#include "state.h"
+
+// Inserts, transfers and joins on 10k to 1M validator states, kept as
+// ordered sets of heap vectors, as ordered sets of interned states and as a
+// StateSet.
+
+using namespace AST;
+
+double Since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration <double, std::milli> (std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+    const int slots = 64;
+    State base;
+    for (int i = 0; i < slots; i++) {
+        base = base.Push({-1, 0});
+    }
+
+    for (int n : {10000, 100000, 1000000}) {
+        // Distinct states that differ in two slots each.
+        std::vector <State> states;
+        for (int i = 0; i < n; i++) {
+            states.push_back(base.Set(i % slots, {i / slots, 0}).Set((i * 7 + 3) % slots, {i % 97, 1}));
+        }
+        std::vector <std::vector <Slot>> heaps;
+        for (State state : states) {
+            heaps.push_back(state.Heap());
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::set <std::vector <Slot>> ordered;
+        for (const std::vector <Slot> &heap : heaps) {
+            ordered.insert(heap);
+        }
+        double ordered_insert = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        std::set <std::vector <Slot>> ordered_next;
+        for (std::vector <Slot> heap : ordered) {
+            heap[0] = {5, 5};
+            ordered_next.insert(heap);
+        }
+        double ordered_transfer = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        ordered_next.insert(ordered.begin(), ordered.end());
+        double ordered_join = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        std::set <State> interned;
+        for (State state : states) {
+            interned.insert(state);
+        }
+        double interned_insert = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        std::set <State> interned_next;
+        for (State state : interned) {
+            interned_next.insert(state.Set(0, {5, 5}));
+        }
+        double interned_transfer = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        interned_next.insert(interned.begin(), interned.end());
+        double interned_join = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        StateSet set;
+        for (State state : states) {
+            set.Insert(state);
+        }
+        double set_insert = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        StateSet next;
+        for (State state : set) {
+            next.Insert(state.Set(0, {5, 5}));
+        }
+        double set_transfer = Since(start);
+
+        start = std::chrono::steady_clock::now();
+        next.Union(set);
+        double set_join = Since(start);
+
+        printf("stateset: %7d states, std::set <heap>  insert %7.1f ms, transfer %7.1f ms, join %7.1f ms\n",
+               n, ordered_insert, ordered_transfer, ordered_join);
+        printf("stateset: %7d states, std::set <State> insert %7.1f ms, transfer %7.1f ms, join %7.1f ms\n",
+               n, interned_insert, interned_transfer, interned_join);
+        printf("stateset: %7d states, StateSet         insert %7.1f ms, transfer %7.1f ms, join %7.1f ms (%zu, %d)\n",
+               n, set_insert, set_transfer, set_join, ordered_next.size(), next.Size());
+    }
+    return 0;
+}
@@ -2,10 +2,11 @@
 #include "ast.h"
 #include "compile.h"
 #include "settings.h"
+#include "symbols.h"
 
 namespace AST {
 
-int findInLocal(std::string &identifier, CPContext &context) {
+int findInLocal(int identifier, CPContext &context) {
     for (int i = (int)context.variable_stack.size() - 1; i >= 0; i--) {
         if (context.variable_stack[i] == identifier) {
             return i;
@@ -14,7 +15,7 @@ int findInLocal(std::string &identifier, CPContext &context) {
     return -1;
 }
 
-int findInArguments(std::string &identifier, CPContext &context) {
+int findInArguments(int identifier, CPContext &context) {
     for (int i = 0; i < (int)context.variable_arguments.size(); i++) {
         if (context.variable_arguments[i] == identifier) {
             return i;
@@ -23,7 +24,18 @@ int findInArguments(std::string &identifier, CPContext &context) {
     return -1;
 }
 
-Type getVariableType(std::string id, Node *node, CPContext &context) {
+// Arguments are numbered after the metavariables in variable_arguments.
+int argumentIndex(int variable, CPContext &context) {
+    return (int)context.variable_arguments.size() - context.argument_count + variable;
+}
+
+Type getVariableType(int id, int variable, Node *node, CPContext &context) {
+    if (variable != -1) {
+        if (variable < context.argument_count) {
+            return context.variable_arguments_type[argumentIndex(variable, context)];
+        }
+        return context.variable_stack_type[variable - context.argument_count];
+    }
     for (int i = (int)context.variable_stack.size() - 1; i >= 0; i--) {
         if (context.variable_stack[i] == id) {
             return context.variable_stack_type[i];
@@ -38,7 +50,10 @@ Type getVariableType(std::string id, Node *node, CPContext &context) {
     exit(1);
 }
 
-int getFunctionIndex(std::string &identifier, CPContext &context) {
+int getFunctionIndex(int identifier, int function, CPContext &context) {
+    if (function != -1) {
+        return context.function_stack[function].second;
+    }
     for (int i = (int)context.function_stack.size() - 1; i >= 0; i--) {
         if (context.function_stack[i].first == identifier) {
             return context.function_stack[i].second;
@@ -48,7 +63,13 @@ int getFunctionIndex(std::string &identifier, CPContext &context) {
     exit(1);
 }
 
-int getPhase(std::string &identifier, CPContext &context) {
+int getPhase(int identifier, int variable, CPContext &context) {
+    if (variable != -1) {
+        if (variable < context.argument_count) {
+            return (argumentIndex(variable, context) + 2) * 4;
+        }
+        return -(variable - context.argument_count + 1) * 4;
+    }
     int idx = findInLocal(identifier, context);
     if (idx != -1) {
         return -(idx + 1) * 4;
@@ -63,8 +84,8 @@ int getPhase(std::string &identifier, CPContext &context) {
     }
 }
 
-void Compile(std::shared_ptr <Node> node, std::ostream &out) {
-    out << "; " << node->filename << " " << node->line_begin + 1 << ":" << node->position_begin + 1 << " -> program\n";
+void Compile(Node *node, std::ostream &out) {
+    out << "; " << node->Filename() << " " << node->line_begin + 1 << ":" << node->position_begin + 1 << " -> program\n";
     out << "global main\n";
     out << "extern malloc\n";
     out << "extern free\n";
@@ -81,7 +102,7 @@ void Compile(std::shared_ptr <Node> node, std::ostream &out) {
 }
 
 void Block::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> block\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> block\n";
     size_t old_variable_stack_size = context.variable_stack.size();
     size_t old_function_stack_size = context.function_stack.size();
     for (auto i = statement_list.begin(); i != statement_list.end(); i++) {
@@ -97,12 +118,12 @@ void Block::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Asm::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> asm\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> asm\n";
     out << code << "\n";
 }
 
 void If::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> if\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> if\n";
     branch_list[0].first->Compile(out, context);
     int idx = context.branch_index;
     context.branch_index++;
@@ -118,7 +139,7 @@ void If::Compile(std::ostream &out, CPContext &context) {
 }
 
 void While::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> while\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> while\n";
     int idx = context.branch_index;
     context.branch_index++;
     out << "_while" << idx << ":\n";
@@ -134,8 +155,8 @@ void FunctionDefinition::Compile(std::ostream &out, CPContext &context) {
     std::string identifier, identifier_end;
     int index;
     if (external) {
-        identifier = name;
-        identifier_end = "_funend" + name;
+        identifier = Symbols::Get(name);
+        identifier_end = "_funend" + Symbols::Get(name);
         index = -1;
     }
     else {
@@ -145,7 +166,7 @@ void FunctionDefinition::Compile(std::ostream &out, CPContext &context) {
         context.function_index++;
     }
 
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> function definition\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> function definition\n";
     if (external) {
         out << "global " << identifier << "\n";
     }
@@ -155,10 +176,11 @@ void FunctionDefinition::Compile(std::ostream &out, CPContext &context) {
     out << "mov ebp, esp\n";
     out << "sub esp, " << (signature->identifiers.size() + 2) * 4 << "\n";
     
-    std::vector <std::string> variable_stack = context.variable_stack;
+    std::vector <int> variable_stack = context.variable_stack;
     std::vector <Type> variable_stack_type = context.variable_stack_type;
-    std::vector <std::string> variable_arguments = context.variable_arguments;
+    std::vector <int> variable_arguments = context.variable_arguments;
     std::vector <Type> variable_arguments_type = context.variable_arguments_type;
+    int argument_count = context.argument_count;
     context.variable_stack.clear();
     context.variable_stack_type.clear();
     context.variable_arguments.clear();
@@ -172,11 +194,13 @@ void FunctionDefinition::Compile(std::ostream &out, CPContext &context) {
         context.variable_arguments.push_back(signature->identifiers[i]);
         context.variable_arguments_type.push_back(signature->types[i]);
     }
+    context.argument_count = (int)signature->identifiers.size();
     body->Compile(out, context);
     context.variable_stack = variable_stack;
     context.variable_stack_type = variable_stack_type;
     context.variable_arguments = variable_arguments;
     context.variable_arguments_type = variable_arguments_type;
+    context.argument_count = argument_count;
 
     out << "leave\n";
     out << "ret\n";
@@ -184,69 +208,76 @@ void FunctionDefinition::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Prototype::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> prototype\n";
-    out << "extern " << name << "\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> prototype\n";
+    out << "extern " << Symbols::Get(name) << "\n";
     context.function_stack.push_back({name, -1});
 }
 
 void Definition::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> definition\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> definition\n";
     context.variable_stack.push_back(identifier);
     context.variable_stack_type.push_back(type);
     out << "sub esp, 4\n";
 }
 
 void Assignment::Compile(std::ostream &out, CPContext &context) {
-    if (getVariableType(identifier, this, context) == Type::Ptr) {
-        if (auto _addition = std::dynamic_pointer_cast <AST::Addition> (value)) {
-            auto _identifier = std::dynamic_pointer_cast <AST::Identifier> (_addition->left);
-            if (_identifier && getVariableType(_identifier->identifier, this, context) == Type::Ptr) {
+    // Included files are parsed once and their nodes shared between every
+    // block that includes them, so the scaled offset is built in temporaries
+    // instead of rewriting value in place.
+    AST::Expression *_value = value;
+    AST::Addition _scaled;
+    AST::Multiplication _multiplication;
+    AST::Integer _integer;
+    if (getVariableType(identifier, variable, this, context) == Type::Ptr) {
+        if (auto _addition = AST::As <AST::Addition> (value)) {
+            auto _identifier = AST::As <AST::Identifier> (_addition->left);
+            if (_identifier && getVariableType(_identifier->identifier, _identifier->variable, this, context) == Type::Ptr) {
                 int line_begin = _addition->right->line_begin;
                 int position_begin = _addition->right->position_begin;
                 int line_end = _addition->right->line_end;
                 int position_end = _addition->right->position_end;
-                std::string filename = _addition->right->filename;
-
-                auto _multiplication = std::make_shared <AST::Multiplication> ();
-                _multiplication->line_begin = line_begin;
-                _multiplication->position_begin = position_begin;
-                _multiplication->line_end = line_end;
-                _multiplication->position_end = position_end;
-                _multiplication->filename = filename;
-
-                auto _integer  = std::make_shared <AST::Integer> ();
-                _integer->line_begin = line_begin;
-                _integer->position_begin = position_begin;
-                _integer->line_end = line_end;
-                _integer->position_end = position_end;
-                _integer->filename = filename;
+                int file = _addition->right->file;
+
+                _multiplication.line_begin = line_begin;
+                _multiplication.position_begin = position_begin;
+                _multiplication.line_end = line_end;
+                _multiplication.position_end = position_end;
+                _multiplication.file = file;
+
+                _integer.line_begin = line_begin;
+                _integer.position_begin = position_begin;
+                _integer.line_end = line_end;
+                _integer.position_end = position_end;
+                _integer.file = file;
                 
-                _multiplication->left = _addition->right;
-                _addition->right = _multiplication;
-                _integer->value = 4;
-                _multiplication->right = _integer;
+                _scaled = *_addition;
+                _multiplication.left = _addition->right;
+                _scaled.right = &_multiplication;
+                _integer.value = 4;
+                _multiplication.right = &_integer;
+                _value = &_scaled;
             }
         }
     }
 
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> assignment\n";
-    value->Compile(out, context);
-    int phase = getPhase(identifier, context);
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> assignment\n";
+    _value->Compile(out, context);
+    int phase = getPhase(identifier, variable, context);
     out << "mov eax, [esp - 4]\n";
     out << "mov [ebp + " << phase << "], eax\n";
 }
 
 void Movement::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> movement\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> movement\n";
     value->Compile(out, context);
-    int phase = getPhase(identifier, context);
+    int phase = getPhase(identifier, variable, context);
     out << "mov eax, [esp - 4]\n";
     out << "mov ebx, [ebp + " << phase << "]\n";
     out << "mov [ebx], eax\n";
 }
 
 void MovementString::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> movement string\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> movement string\n";
     int idx = context.branch_index;
     context.branch_index++;
     out << "jmp _strbufend" << idx << "\n";
@@ -262,22 +293,22 @@ void MovementString::Compile(std::ostream &out, CPContext &context) {
     }
     out << "_strbufend" << idx << ":\n";
     out << "mov esi, _strbuf" << idx << "\n";
-    int phase = getPhase(identifier, context);
+    int phase = getPhase(identifier, variable, context);
     out << "mov edi, [ebp + " << phase << "]\n";
     out << "mov ecx, " << (int)value.size() << "\n";
     out << "rep movsb\n";
 }
 
 void Assumption::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> assumption\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> assumption\n";
 
     int ind_error = context.branch_index++;
     out << "jmp aftererror" << ind_error << "\n";
-    std::string error = "Assumption fault in file " + filename + " on line " + std::to_string(line_begin + 1) + " position " + std::to_string(position_begin + 1);
+    std::string error = "Assumption fault in file " + Filename() + " on line " + std::to_string(line_begin + 1) + " position " + std::to_string(position_begin + 1);
     out << "error" << ind_error << " db \"" << error << "\", 0xA\n";
     out << "aftererror" << ind_error << ":\n";
 
-    int phase = getPhase(identifier, context);
+    int phase = getPhase(identifier, variable, context);
     int idx = context.branch_index++;
     left->Compile(out, context);
     out << "mov eax, [ebp + " << phase << "]\n";
@@ -316,14 +347,14 @@ void Assumption::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Identifier::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> identifier\n";
-    int phase = getPhase(identifier, context);
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> identifier\n";
+    int phase = getPhase(identifier, variable, context);
     out << "mov eax, [ebp + " << phase << "]\n";
     out << "mov [esp - 4], eax\n";
 }
 
 void Integer::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> integer\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> integer\n";
     out << "mov [esp - 4], dword " << value << "\n";
 }
 
@@ -332,29 +363,28 @@ void Alloc::Compile(std::ostream &out, CPContext &context) {
     int position_begin = expression->position_begin;
     int line_end = expression->line_end;
     int position_end = expression->position_end;
-    std::string filename = expression->filename;
-
-    auto _multiplication = std::make_shared <AST::Multiplication> ();
-    _multiplication->line_begin = line_begin;
-    _multiplication->position_begin = position_begin;
-    _multiplication->line_end = line_end;
-    _multiplication->position_end = position_end;
-    _multiplication->filename = filename;
-
-    auto _integer  = std::make_shared <AST::Integer> ();
-    _integer->line_begin = line_begin;
-    _integer->position_begin = position_begin;
-    _integer->line_end = line_end;
-    _integer->position_end = position_end;
-    _integer->filename = filename;
-
-    _integer->value = 4;
-    _multiplication->left = expression;
-    _multiplication->right = _integer;
-    expression = _multiplication;
-
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> alloc\n";
-    expression->Compile(out, context);
+    int file = expression->file;
+
+    AST::Multiplication _multiplication;
+    _multiplication.line_begin = line_begin;
+    _multiplication.position_begin = position_begin;
+    _multiplication.line_end = line_end;
+    _multiplication.position_end = position_end;
+    _multiplication.file = file;
+
+    AST::Integer _integer;
+    _integer.line_begin = line_begin;
+    _integer.position_begin = position_begin;
+    _integer.line_end = line_end;
+    _integer.position_end = position_end;
+    _integer.file = file;
+
+    _integer.value = 4;
+    _multiplication.left = expression;
+    _multiplication.right = &_integer;
+
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> alloc\n";
+    _multiplication.Compile(out, context);
     out << "push dword [esp - 4]\n";
     out << "call malloc\n";
     out << "add esp, 4\n";
@@ -362,7 +392,7 @@ void Alloc::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Free::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> free\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> free\n";
     arg->Compile(out, context);
     out << "push dword [esp - 4]\n";
     out << "call free\n";
@@ -370,32 +400,32 @@ void Free::Compile(std::ostream &out, CPContext &context) {
 }
 
 void FunctionCall::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> function call\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> function call\n";
     for (int i = (int)arguments.size() - 1; i >= 0; i--) {
-        int phase = getPhase(arguments[i], context);
+        int phase = getPhase(arguments[i], argument_variables[i], context);
         out << "push dword [ebp + " << phase << "]\n";
     }
     for (int i = (int)metavariables.size() - 1; i >= 0; i--) {
         metavariables[i].second->Compile(out, context);
         out << "push dword [esp - 4]\n";
     }
-    int idx = getFunctionIndex(identifier, context);
+    int idx = getFunctionIndex(identifier, function, context);
     if (idx == -1) {
-        out << "call " << identifier << "\n";
+        out << "call " << Symbols::Get(identifier) << "\n";
     }
     else {
         out << "call _fun" << idx << "\n";
     }
     out << "add esp, " << (int)(arguments.size() + metavariables.size()) * 4 << "\n";
     for (int i = (int)arguments.size() - 1; i >= 0; i--) {
-        int phase = getPhase(arguments[i], context);
+        int phase = getPhase(arguments[i], argument_variables[i], context);
         out << "mov eax, [esp - " << (((int)arguments.size() - i) * 4) << "]\n";
         out << "mov [ebp + " << phase << "], eax\n";
     }
 }
 
 void Dereference::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> dereference\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> dereference\n";
     arg->Compile(out, context);
     out << "mov eax, [esp - 4]\n";
     out << "mov ebx, [eax]\n";
@@ -403,10 +433,10 @@ void Dereference::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Addition::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> addition\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> addition\n";
     left->Compile(out, context);
     out << "sub esp, 4\n";
-    context.variable_stack.push_back("__junk");
+    context.variable_stack.push_back(-1);
     context.variable_stack_type.push_back(Type::Int);
     right->Compile(out, context);
     out << "add esp, 4\n";
@@ -418,10 +448,10 @@ void Addition::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Subtraction::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> subtraction\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> subtraction\n";
     left->Compile(out, context);
     out << "sub esp, 4\n";
-    context.variable_stack.push_back("__junk");
+    context.variable_stack.push_back(-1);
     context.variable_stack_type.push_back(Type::Int);
     right->Compile(out, context);
     out << "add esp, 4\n";
@@ -433,10 +463,10 @@ void Subtraction::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Multiplication::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> multiplication\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> multiplication\n";
     left->Compile(out, context);
     out << "sub esp, 4\n";
-    context.variable_stack.push_back("__junk");
+    context.variable_stack.push_back(-1);
     context.variable_stack_type.push_back(Type::Int);
     right->Compile(out, context);
     out << "add esp, 4\n";
@@ -449,10 +479,10 @@ void Multiplication::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Division::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> division\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> division\n";
     left->Compile(out, context);
     out << "sub esp, 4\n";
-    context.variable_stack.push_back("__junk");
+    context.variable_stack.push_back(-1);
     context.variable_stack_type.push_back(Type::Int);
     right->Compile(out, context);
     out << "add esp, 4\n";
@@ -465,10 +495,10 @@ void Division::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Less::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> less\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> less\n";
     left->Compile(out, context);
     out << "sub esp, 4\n";
-    context.variable_stack.push_back("__junk");
+    context.variable_stack.push_back(-1);
     context.variable_stack_type.push_back(Type::Int);
     right->Compile(out, context);
     out << "add esp, 4\n";
@@ -486,10 +516,10 @@ void Less::Compile(std::ostream &out, CPContext &context) {
 }
 
 void Equal::Compile(std::ostream &out, CPContext &context) {
-    out << "; " << filename << " " << line_begin + 1 << ":" << position_begin + 1 << " -> equal\n";
+    out << "; " << Filename() << " " << line_begin + 1 << ":" << position_begin + 1 << " -> equal\n";
     left->Compile(out, context);
     out << "sub esp, 4\n";
-    context.variable_stack.push_back("__junk");
+    context.variable_stack.push_back(-1);
     context.variable_stack_type.push_back(Type::Int);
     right->Compile(out, context);
     out << "add esp, 4\n";
@@ -4,7 +4,7 @@
 #include "ast.h"
 
 namespace AST {
-    void Compile(std::shared_ptr <AST::Node> node, std::ostream &_out);
+    void Compile(AST::Node *node, std::ostream &_out);
 }
 
 #endif // COMPILE_H_INCLUDED
\ No newline at end of file
@@ -0,0 +1,594 @@
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "state.h"
+
+namespace AST {
+    // Node of a reduced ordered decision diagram over the slots of heaps. A
+    // node of height h stands for a set of heap suffixes of length h: each
+    // edge is labelled with a value of the first slot of the suffix and
+    // leads to the node of the rest of the suffixes with that value. Edges
+    // are sorted by label and never lead to the empty set, and nodes are
+    // hash-consed, so equal sets are the same node.
+    struct DiagramNode {
+        int height;
+        std::vector <std::pair <Slot, int>> edges;
+    };
+
+    typedef std::vector <std::pair <Slot, int>> Edges;
+
+    // The empty set, and the set of the empty suffix only.
+    const int empty_node = 0;
+    const int unit_node = 1;
+
+    std::deque <DiagramNode> nodes = {{0, {}}, {0, {}}};
+
+    struct NodeHash {
+        size_t operator ()(int id) const {
+            const DiagramNode &node = nodes[id];
+            uint64_t hash = (uint64_t)node.height * 0x9E3779B97F4A7C15ull;
+            for (const auto &edge : node.edges) {
+                const Slot &slot = edge.first;
+                hash ^= ((uint64_t)(uint32_t)slot.first << 32 | (uint32_t)slot.second) + (uint64_t)(uint32_t)slot.last * 0xBF58476D1CE4E5B9ull + (uint64_t)edge.second;
+                hash *= 0x94D049BB133111EBull;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
+    };
+
+    struct NodeEqual {
+        bool operator ()(int a, int b) const {
+            return nodes[a].height == nodes[b].height && nodes[a].edges == nodes[b].edges;
+        }
+    };
+
+    std::unordered_set <int, NodeHash, NodeEqual> unique_nodes;
+    // Diagram operations run under this lock, so that validations on
+    // several threads can share the nodes.
+    std::mutex diagram_mutex;
+
+    int MakeNode(int height, Edges &&edges) {
+        if (edges.empty()) {
+            return empty_node;
+        }
+        nodes.push_back({height, std::move(edges)});
+        int id = (int)nodes.size() - 1;
+        auto inserted = unique_nodes.insert(id);
+        if (!inserted.second) {
+            nodes.pop_back();
+            return *inserted.first;
+        }
+        return id;
+    }
+
+    // Results of an operation by node, or by pair of nodes for unions.
+    typedef std::unordered_map <uint64_t, int> Memo;
+
+    uint64_t PairKey(int a, int b) {
+        return (uint64_t)(uint32_t)a << 32 | (uint32_t)b;
+    }
+
+    int Union(int a, int b, Memo &memo) {
+        if (a == empty_node || a == b) {
+            return b;
+        }
+        if (b == empty_node) {
+            return a;
+        }
+        if (a > b) {
+            std::swap(a, b);
+        }
+        auto it = memo.find(PairKey(a, b));
+        if (it != memo.end()) {
+            return it->second;
+        }
+        const DiagramNode &x = nodes[a], &y = nodes[b];
+        Edges edges;
+        size_t i = 0, j = 0;
+        while (i < x.edges.size() || j < y.edges.size()) {
+            if (j == y.edges.size() || (i < x.edges.size() && x.edges[i].first < y.edges[j].first)) {
+                edges.push_back(x.edges[i++]);
+            }
+            else if (i == x.edges.size() || y.edges[j].first < x.edges[i].first) {
+                edges.push_back(y.edges[j++]);
+            }
+            else {
+                edges.push_back({x.edges[i].first, Union(x.edges[i].second, y.edges[j].second, memo)});
+                i++;
+                j++;
+            }
+        }
+        int result = MakeNode(x.height, std::move(edges));
+        memo[PairKey(a, b)] = result;
+        return result;
+    }
+
+    // Node of edges whose labels were changed, joining the edges that got
+    // equal labels.
+    int MergeEdges(int height, Edges &&edges, Memo &unions) {
+        std::stable_sort(edges.begin(), edges.end(), [](const std::pair <Slot, int> &a, const std::pair <Slot, int> &b) {
+            return a.first < b.first;
+        });
+        Edges merged;
+        for (auto &edge : edges) {
+            if (edge.second == empty_node) {
+                continue;
+            }
+            if (!merged.empty() && merged.back().first == edge.first) {
+                merged.back().second = Union(merged.back().second, edge.second, unions);
+            }
+            else {
+                merged.push_back(edge);
+            }
+        }
+        return MakeNode(height, std::move(merged));
+    }
+
+    // Rebuilds the diagram with visit applied to the nodes at height
+    // target, and the children of those above it rebuilt the same way.
+    template <class Visit>
+    int Rebuild(int node, int target, Visit visit, Memo &memo) {
+        if (node == empty_node) {
+            return empty_node;
+        }
+        auto it = memo.find(node);
+        if (it != memo.end()) {
+            return it->second;
+        }
+        const DiagramNode &x = nodes[node];
+        int result;
+        if (x.height == target) {
+            result = visit(node);
+        }
+        else {
+            Edges edges;
+            for (const auto &edge : x.edges) {
+                int child = Rebuild(edge.second, target, visit, memo);
+                if (child != empty_node) {
+                    edges.push_back({edge.first, child});
+                }
+            }
+            result = MakeNode(x.height, std::move(edges));
+        }
+        memo[node] = result;
+        return result;
+    }
+
+    // Applies map(height, slot) to every label.
+    template <class Map>
+    int Relabel(int node, Map map, Memo &memo, Memo &unions) {
+        if (node == empty_node || node == unit_node) {
+            return node;
+        }
+        auto it = memo.find(node);
+        if (it != memo.end()) {
+            return it->second;
+        }
+        const DiagramNode &x = nodes[node];
+        Edges edges;
+        for (const auto &edge : x.edges) {
+            edges.push_back({map(x.height, edge.first), Relabel(edge.second, map, memo, unions)});
+        }
+        int result = MergeEdges(x.height, std::move(edges), unions);
+        memo[node] = result;
+        return result;
+    }
+
+    int SetLabel(int node, int height, Slot slot) {
+        Memo memo, unions;
+        return Rebuild(node, height, [&](int target) {
+            int child = empty_node;
+            for (const auto &edge : nodes[target].edges) {
+                child = Union(child, edge.second, unions);
+            }
+            return MakeNode(height, {{slot, child}});
+        }, memo);
+    }
+
+    int Restrict(int node, int height, const std::function <bool (Slot)> &keep) {
+        Memo memo;
+        return Rebuild(node, height, [&](int target) {
+            Edges edges;
+            for (const auto &edge : nodes[target].edges) {
+                if (keep(edge.first)) {
+                    edges.push_back(edge);
+                }
+            }
+            return MakeNode(height, std::move(edges));
+        }, memo);
+    }
+
+    void CollectValues(int node, int height, std::unordered_set <int> &visited, std::vector <Slot> &values) {
+        if (node == empty_node || !visited.insert(node).second) {
+            return;
+        }
+        const DiagramNode &x = nodes[node];
+        for (const auto &edge : x.edges) {
+            if (x.height == height) {
+                values.push_back(edge.first);
+            }
+            else {
+                CollectValues(edge.second, height, visited, values);
+            }
+        }
+    }
+
+    std::vector <Slot> Values(int node, int height) {
+        std::unordered_set <int> visited;
+        std::vector <Slot> values;
+        CollectValues(node, height, visited, values);
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        return values;
+    }
+
+    int Build(const std::vector <std::vector <Slot>> &heaps, int low, int high, int level, int size) {
+        if (level == size) {
+            return unit_node;
+        }
+        Edges edges;
+        for (int i = low; i < high; ) {
+            int j = i + 1;
+            while (j < high && heaps[j][level] == heaps[i][level]) {
+                j++;
+            }
+            edges.push_back({heaps[i][level], Build(heaps, i, j, level + 1, size)});
+            i = j;
+        }
+        return MakeNode(size - level, std::move(edges));
+    }
+
+    // Number of heaps in the set, at most INT_MAX.
+    int Paths(int node, std::unordered_map <int, int> &memo) {
+        if (node == empty_node || node == unit_node) {
+            return node == unit_node;
+        }
+        auto it = memo.find(node);
+        if (it != memo.end()) {
+            return it->second;
+        }
+        long long result = 0;
+        for (const auto &edge : nodes[node].edges) {
+            result = std::min <long long> (INT_MAX, result + Paths(edge.second, memo));
+        }
+        memo[node] = (int)result;
+        return (int)result;
+    }
+
+    void Enumerate(int node, State prefix, std::vector <State> &states) {
+        if (node == unit_node) {
+            states.push_back(prefix);
+            return;
+        }
+        for (const auto &edge : nodes[node].edges) {
+            Enumerate(edge.second, prefix.Push(edge.first), states);
+        }
+    }
+
+    StateSet StateSet::FromDiagram(int root, int heap_size) {
+        StateSet set;
+        set.expanded = false;
+        set.diagram = root;
+        set.heap_size = heap_size;
+        return set;
+    }
+
+    int StateSet::Diagram() const {
+        if (diagram == -1) {
+            std::vector <std::vector <Slot>> heaps;
+            for (State state : Sorted(*this)) {
+                heaps.push_back(state.Heap());
+            }
+            heap_size = heaps.empty() ? 0 : (int)heaps[0].size();
+            diagram = heaps.empty() ? empty_node : Build(heaps, 0, (int)heaps.size(), 0, heap_size);
+        }
+        return diagram;
+    }
+
+    void StateSet::Expand() const {
+        if (expanded) {
+            return;
+        }
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        states.clear();
+        if (diagram != empty_node) {
+            Enumerate(diagram, State(), states);
+        }
+        size_t capacity = 16;
+        while (capacity < states.size() * 2) {
+            capacity *= 2;
+        }
+        Rehash(capacity);
+        expanded = true;
+    }
+
+    int StateSet::Count() const {
+        if (count != -1) {
+            return count;
+        }
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        std::unordered_map <int, int> memo;
+        count = Paths(diagram, memo);
+        return count;
+    }
+
+    bool StateSet::UnionDiagrams(const StateSet &other) {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int a = Diagram(), b = other.Diagram();
+        Memo unions;
+        int root = AST::Union(a, b, unions);
+        bool added = root != a;
+        *this = FromDiagram(root, a == empty_node ? other.heap_size : heap_size);
+        return added;
+    }
+
+    StateSet StateSet::Set(int index, Slot slot) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        return FromDiagram(SetLabel(root, heap_size - index, slot), heap_size);
+    }
+
+    StateSet StateSet::Push(Slot slot) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        int leaf = MakeNode(1, {{slot, unit_node}});
+        Memo memo;
+        std::function <int (int)> push = [&](int node) {
+            if (node == empty_node || node == unit_node) {
+                return node == unit_node ? leaf : empty_node;
+            }
+            auto it = memo.find(node);
+            if (it != memo.end()) {
+                return it->second;
+            }
+            const DiagramNode &x = nodes[node];
+            Edges edges;
+            for (const auto &edge : x.edges) {
+                edges.push_back({edge.first, push(edge.second)});
+            }
+            int result = MakeNode(x.height + 1, std::move(edges));
+            memo[node] = result;
+            return result;
+        };
+        return FromDiagram(push(root), heap_size + 1);
+    }
+
+    StateSet StateSet::Pop(int count) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        if (count <= 0) {
+            return FromDiagram(root, heap_size);
+        }
+        Memo memo;
+        std::function <int (int)> pop = [&](int node) {
+            if (node == empty_node) {
+                return empty_node;
+            }
+            const DiagramNode &x = nodes[node];
+            if (x.height == count) {
+                return unit_node;
+            }
+            auto it = memo.find(node);
+            if (it != memo.end()) {
+                return it->second;
+            }
+            Edges edges;
+            for (const auto &edge : x.edges) {
+                edges.push_back({edge.first, pop(edge.second)});
+            }
+            int result = MakeNode(x.height - count, std::move(edges));
+            memo[node] = result;
+            return result;
+        };
+        return FromDiagram(pop(root), heap_size - count);
+    }
+
+    StateSet StateSet::ClearPacket(int packet, int except) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        int except_height = heap_size - except;
+        Memo memo, unions;
+        int result = Relabel(root, [&](int height, Slot slot) {
+            if (height != except_height && PacketOf(slot.first) == packet) {
+                return Slot(-1, 0);
+            }
+            return slot;
+        }, memo, unions);
+        return FromDiagram(result, heap_size);
+    }
+
+    StateSet StateSet::Swap(int a, int b) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        if (a == b) {
+            return FromDiagram(root, heap_size);
+        }
+        Memo memo, unions;
+        int result = Relabel(root, [&](int, Slot slot) {
+            int packet = PacketOf(slot.first);
+            if (packet == a || packet == b) {
+                int other = packet == a ? b : a;
+                slot.first = slot.first >= 0 ? other : -2 - other;
+            }
+            return slot;
+        }, memo, unions);
+        return FromDiagram(result, heap_size);
+    }
+
+    StateSet StateSet::Copy(int from, int index, const std::function <Slot (Slot)> &f) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        int height = heap_size - index;
+        if (from == index) {
+            Memo memo, unions;
+            int result = Relabel(root, [&](int level, Slot slot) {
+                return level == height ? f(slot) : slot;
+            }, memo, unions);
+            return FromDiagram(result, heap_size);
+        }
+        // The union over the values v of slot from of the states with that
+        // value, with slot index set to f(v).
+        int from_height = heap_size - from;
+        int result = empty_node;
+        Memo unions;
+        for (Slot value : AST::Values(root, from_height)) {
+            int part = SetLabel(Restrict(root, from_height, [&](Slot slot) {
+                return slot == value;
+            }), height, f(value));
+            result = AST::Union(result, part, unions);
+        }
+        return FromDiagram(result, heap_size);
+    }
+
+    StateSet StateSet::Where(int index, const std::function <bool (Slot)> &keep) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        return FromDiagram(Restrict(root, heap_size - index, keep), heap_size);
+    }
+
+    std::vector <Slot> StateSet::Values(int index) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = Diagram();
+        return AST::Values(root, heap_size - index);
+    }
+
+    bool StateSet::Misses(int packet) const {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        std::unordered_map <int, bool> memo;
+        std::function <bool (int)> misses = [&](int node) {
+            if (node == empty_node || node == unit_node) {
+                return node == unit_node;
+            }
+            auto it = memo.find(node);
+            if (it != memo.end()) {
+                return it->second;
+            }
+            bool result = false;
+            for (const auto &edge : nodes[node].edges) {
+                if (edge.first.first != packet && misses(edge.second)) {
+                    result = true;
+                    break;
+                }
+            }
+            memo[node] = result;
+            return result;
+        };
+        return misses(Diagram());
+    }
+
+    int CountNodes(int node, std::unordered_set <int> &visited) {
+        if (node == empty_node || node == unit_node || !visited.insert(node).second) {
+            return 0;
+        }
+        int count = 1;
+        for (const auto &edge : nodes[node].edges) {
+            count += CountNodes(edge.second, visited);
+        }
+        return count;
+    }
+
+    // Labels the edges of grouped packets with their group instead, which
+    // merges exactly the states that differ in the numbers of grouped
+    // packets only, and compares the number of states.
+    bool Canonicalizer::MayMergeDiagram(const StateSet &states) {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = states.Diagram();
+        Memo memo, unions;
+        int grouped = Relabel(root, [&](int, Slot slot) {
+            int packet = PacketOf(slot.first);
+            if (slot.first != -1 && group[packet] != -1) {
+                slot.first = INT_MIN + 2 * group[packet] + (slot.first < -1);
+            }
+            return slot;
+        }, memo, unions);
+        std::unordered_map <int, int> paths;
+        int count = Paths(root, paths);
+        return count == INT_MAX || Paths(grouped, paths) < count;
+    }
+
+    // Renumbering rebuilds nodes once for each list of grouped packets met
+    // on the way to them, in order of first reference, so it can unshare
+    // the diagram up to one path per state. It gives up when the diagram
+    // would grow past renumber_growth times its size, and the caller then
+    // renumbers the states one by one.
+    const int renumber_growth = 2;
+
+    bool Canonicalizer::operator ()(const StateSet &states, StateSet &result) {
+        std::lock_guard <std::mutex> lock(diagram_mutex);
+        int root = states.Diagram();
+        auto cached = renumbered_roots.find(root);
+        if (cached != renumbered_roots.end()) {
+            if (cached->second == -1) {
+                return false;
+            }
+            result = StateSet::FromDiagram(cached->second, states.heap_size);
+            return true;
+        }
+        std::unordered_set <int> visited;
+        size_t budget = (size_t)renumber_growth * CountNodes(root, visited);
+        bool aborted = false;
+        std::map <std::pair <int, std::vector <int>>, int> memo;
+        Memo unions;
+        std::function <int (int, const std::vector <int>&)> renumber = [&](int node, const std::vector <int> &seen) {
+            if (node == empty_node || node == unit_node || aborted) {
+                return node;
+            }
+            auto key = std::make_pair(node, seen);
+            auto it = memo.find(key);
+            if (it != memo.end()) {
+                return it->second;
+            }
+            if (memo.size() > budget) {
+                aborted = true;
+                return node;
+            }
+            const DiagramNode &x = nodes[node];
+            Edges edges;
+            for (const auto &edge : x.edges) {
+                Slot slot = edge.first;
+                int packet = PacketOf(slot.first);
+                if (slot.first == -1 || group[packet] == -1) {
+                    edges.push_back({slot, renumber(edge.second, seen)});
+                    continue;
+                }
+                int g = group[packet], rank = 0;
+                bool found = false;
+                for (int other : seen) {
+                    if (other == packet) {
+                        found = true;
+                        break;
+                    }
+                    rank += group[other] == g;
+                }
+                int target = members[g][rank];
+                slot.first = slot.first >= 0 ? target : -2 - target;
+                if (found) {
+                    edges.push_back({slot, renumber(edge.second, seen)});
+                }
+                else {
+                    std::vector <int> next = seen;
+                    next.push_back(packet);
+                    edges.push_back({slot, renumber(edge.second, next)});
+                }
+            }
+            int result = MergeEdges(x.height, std::move(edges), unions);
+            memo[key] = result;
+            return result;
+        };
+        int renumbered = renumber(root, {});
+        if (aborted) {
+            renumbered_roots[root] = -1;
+            return false;
+        }
+        renumbered_roots[root] = renumbered;
+        result = StateSet::FromDiagram(renumbered, states.heap_size);
+        return true;
+    }
+}
@@ -3,6 +3,7 @@
 
 #include <stdexcept>
 #include "token.h"
+#include "source.h"
 #include "ast.h"
 
 class AliasException : public std::exception {
@@ -16,13 +17,11 @@ public:
         filename = _filename;
     }
 
-    AliasException(std::string _value, Token _token) {
+    AliasException(std::string _value, const Token &_token) {
         value = _value;
-        line_begin = _token.line_begin;
-        position_begin = _token.position_begin;
-        line_end = _token.line_end;
-        position_end = _token.position_end;
-        filename = _token.filename;
+        Source::Locate(_token.file, _token.begin, line_begin, position_begin);
+        Source::Locate(_token.file, _token.end, line_end, position_end);
+        filename = Source::GetFile(_token.file).filename;
     }
 
     AliasException(std::string _value, AST::Node *_node) {
@@ -31,7 +30,7 @@ public:
         position_begin = _node->position_begin;
         line_end = _node->line_end;
         position_end = _node->position_end;
-        filename = _node->filename;
+        filename = _node->Filename();
     }
 
     std::string value;
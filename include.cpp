@@ -0,0 +1,153 @@
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "include.h"
+#include "astcache.h"
+#include "exception.h"
+#include "lexer.h"
+#include "process.h"
+#include "settings.h"
+#include "symbols.h"
+#include "threadpool.h"
+
+namespace Include {
+    struct Entry {
+        AST::Block *block = nullptr;
+        bool parsing = false;
+    };
+
+    std::map <std::string, Entry> cache;
+    int hits = 0;
+    int misses = 0;
+
+    struct Unit {
+        AST::Node *node = nullptr;
+        std::vector <Syntax::Splice> splices;
+    };
+
+    std::mutex preload_mutex;
+    std::set <std::string> discovered;
+    std::map <std::string, Unit> units;
+    int preload_threads = 0;
+
+    void PreloadFile(ThreadPool &pool, std::string filename);
+
+    void Discover(ThreadPool &pool, const Token &token) {
+        std::string inc_filename = Symbols::Get(token.value);
+        std::lock_guard <std::mutex> lock(preload_mutex);
+        if (discovered.insert(inc_filename).second) {
+            pool.Submit([&pool, inc_filename] { PreloadFile(pool, inc_filename); });
+        }
+    }
+
+    void PreloadFile(ThreadPool &pool, std::string filename) {
+        Source::Buffer source(filename);
+        if (!source.Good()) {
+            return;
+        }
+        Unit unit;
+        bool use_cache = !Settings::GetCacheDirectory().empty();
+        uint64_t hash = 0;
+        if (use_cache) {
+            hash = ASTCache::Hash(source.View());
+            if (ASTCache::Load(filename, hash, unit.node, unit.splices)) {
+                for (const Syntax::Splice &splice : unit.splices) {
+                    Discover(pool, splice.token);
+                }
+                std::lock_guard <std::mutex> lock(preload_mutex);
+                units[filename] = std::move(unit);
+                return;
+            }
+        }
+
+        std::vector <Token> token_stream;
+        try {
+            token_stream = Lexer::Process(source);
+        }
+        catch (AliasException &ex) {
+            return;
+        }
+
+        for (const Token &token : token_stream) {
+            if (token.type == TokenType::Include) {
+                Discover(pool, token);
+            }
+        }
+
+        Syntax::DeferIncludes(&unit.splices);
+        try {
+            unit.node = Syntax::Process(token_stream);
+        }
+        catch (AliasException &ex) {
+            Syntax::DeferIncludes(nullptr);
+            return;
+        }
+        Syntax::DeferIncludes(nullptr);
+        if (use_cache) {
+            ASTCache::Store(hash, token_stream.back().file, unit.node, unit.splices);
+        }
+
+        std::lock_guard <std::mutex> lock(preload_mutex);
+        units[filename] = std::move(unit);
+    }
+
+    void Preload(std::string filename) {
+        ThreadPool pool((int)std::max(1u, std::thread::hardware_concurrency()));
+        preload_threads = pool.Size();
+        discovered.insert(filename);
+        pool.Submit([&pool, filename] { PreloadFile(pool, filename); });
+        pool.Wait();
+    }
+
+    bool Take(std::string filename, AST::Node *&node, std::vector <Syntax::Splice> &splices) {
+        auto it = units.find(filename);
+        if (it == units.end()) {
+            return false;
+        }
+        node = it->second.node;
+        splices = std::move(it->second.splices);
+        units.erase(it);
+        return true;
+    }
+
+    AST::Block *Get(std::string filename, const Token &token) {
+        char *path = realpath(filename.c_str(), nullptr);
+        if (!path) {
+            throw AliasException("Could not open file " + filename, token);
+        }
+        std::string key(path);
+        free(path);
+
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            if (it->second.parsing) {
+                throw AliasException("Recursive include of file " + filename, token);
+            }
+            hits++;
+            if (Settings::GetIncludeOnce()) {
+                return nullptr;
+            }
+            return it->second.block;
+        }
+
+        misses++;
+        cache[key].parsing = true;
+        AST::Block *block = AST::As <AST::Block> (Parse(filename));
+        Entry &entry = cache[key];
+        entry.block = block;
+        entry.parsing = false;
+        return block;
+    }
+
+    void PrintStatistics() {
+        std::cout << "Include cache: " << hits << " hits, " << misses << " misses, " << cache.size() << " files\n";
+        std::cout << "Include preload: " << discovered.size() << " files on " << preload_threads << " threads\n";
+        if (!Settings::GetCacheDirectory().empty()) {
+            ASTCache::PrintStatistics();
+        }
+    }
+}
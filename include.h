@@ -0,0 +1,30 @@
+#ifndef INCLUDE_H_INCLUDED
+#define INCLUDE_H_INCLUDED
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "token.h"
+#include "ast.h"
+#include "syntax.h"
+
+namespace Include {
+    // Returns the parsed block of an included file. Files are keyed by their
+    // canonical path and parsed at most once per run; later includes share
+    // the cached statements. In include-once mode a repeated include returns
+    // nullptr and contributes nothing. Throws AliasException at the include
+    // token when the file does not exist or includes itself.
+    AST::Block *Get(std::string filename, const Token &token);
+    // Lexes and parses the include tree rooted at filename on a thread pool
+    // ahead of the serial parse. Files are found by scanning token streams
+    // for includes; their includes are left as splices.
+    void Preload(std::string filename);
+    // Hands out the preloaded parse of a file, spelled as in the include,
+    // at most once. Returns false when the file was not preloaded or failed
+    // to lex or parse, in which case the caller parses it itself and reports
+    // the error exactly like the serial path.
+    bool Take(std::string filename, AST::Node *&node, std::vector <Syntax::Splice> &splices);
+    void PrintStatistics();
+}
+
+#endif // INCLUDE_H_INCLUDED
@@ -1,362 +1,339 @@
-#include <functional>
+#include <algorithm>
+#include <cstring>
 #include "lexer.h"
+#include "symbols.h"
 #include "exception.h"
 
-std::vector <Token> Lexer::Process(std::string str, std::string filename) {
-    std::function <bool(char)> is_alpha = [](char c) -> bool { 
-        return ((c >= 'A' && c <= 'Z') ||
-                (c >= 'a' && c <= 'z') || c == '_');
+namespace Lexer {
+    enum class CharClass : unsigned char {
+        Other,
+        Alpha,
+        Digit,
+        Space,
+        Newline,
+        Single,
+        Colon,
+        Less,
+        Minus,
+        Slash,
+        Quote,
     };
 
-    std::function <bool(char)> is_digit = [](char c) -> bool {
-        return (c >= '0' && c <= '9');
+    struct CharTable {
+        CharClass cls[256];
+        TokenType single[256];
+        int escape[256];
     };
 
-    auto is_reserved_word = [&](std::string &str, std::string word, int i) -> bool {
-        size_t n = word.size();
-        return (i + n <= str.size() && str.substr(i, n) == word &&
-                (i + n == str.size() ||
-                (!is_digit(str[i + n]) && !is_alpha(str[i + n]))));
+    constexpr CharTable MakeCharTable() {
+        CharTable table = {};
+        for (int c = 0; c < 256; c++) {
+            table.cls[c] = CharClass::Other;
+            table.single[c] = TokenType::Eof;
+            table.escape[c] = -1;
+        }
+        for (int c = 'A'; c <= 'Z'; c++) table.cls[c] = CharClass::Alpha;
+        for (int c = 'a'; c <= 'z'; c++) table.cls[c] = CharClass::Alpha;
+        for (int c = '0'; c <= '9'; c++) table.cls[c] = CharClass::Digit;
+        table.cls[(unsigned char)'_'] = CharClass::Alpha;
+        table.cls[(unsigned char)' '] = CharClass::Space;
+        table.cls[(unsigned char)'\t'] = CharClass::Space;
+        table.cls[(unsigned char)'\n'] = CharClass::Newline;
+        table.cls[(unsigned char)':'] = CharClass::Colon;
+        table.cls[(unsigned char)'<'] = CharClass::Less;
+        table.cls[(unsigned char)'-'] = CharClass::Minus;
+        table.cls[(unsigned char)'/'] = CharClass::Slash;
+        table.cls[(unsigned char)'\"'] = CharClass::Quote;
+
+        const char singles[] = ",;{}()[]$^+*=";
+        const TokenType single_types[] = {
+            TokenType::Comma, TokenType::Semicolon, TokenType::BraceOpen, TokenType::BraceClose,
+            TokenType::ParenthesisOpen, TokenType::ParenthesisClose, TokenType::BracketOpen,
+            TokenType::BracketClose, TokenType::Dereference, TokenType::Caret, TokenType::Plus,
+            TokenType::Mult, TokenType::Equal,
+        };
+        for (int i = 0; singles[i]; i++) {
+            table.cls[(unsigned char)singles[i]] = CharClass::Single;
+            table.single[(unsigned char)singles[i]] = single_types[i];
+        }
+
+        const char escapes[] = "0abefnrtv\\\'\"?";
+        const int escape_values[] = {0x0, 0x7, 0x8, 0x1B, 0xC, 0xA, 0xD, 0x9, 0xB, 0x5C, 0x27, 0x22, 0x3F};
+        for (int i = 0; escapes[i]; i++) {
+            table.escape[(unsigned char)escapes[i]] = escape_values[i];
+        }
+        return table;
+    }
+
+    constexpr CharTable char_table = MakeCharTable();
+
+    struct Keyword {
+        const char *word;
+        int length;
+        TokenType type;
+    };
+
+    constexpr Keyword keywords[] = {
+        {"asm", 3, TokenType::Asm},
+        {"include", 7, TokenType::Include},
+        {"int", 3, TokenType::Int},
+        {"ptr", 3, TokenType::Ptr},
+        {"if", 2, TokenType::If},
+        {"else", 4, TokenType::Else},
+        {"while", 5, TokenType::While},
+        {"func", 4, TokenType::Func},
+        {"proto", 5, TokenType::Proto},
+        {"def", 3, TokenType::Def},
+        {"const", 5, TokenType::Const},
+        {"assume", 6, TokenType::Assume},
+        {"alloc", 5, TokenType::Alloc},
+        {"free", 4, TokenType::Free},
+        {"call", 4, TokenType::Call},
     };
 
+    const int KeywordHashSize = 32;
+
+    constexpr int KeywordHash(const char *word, int length) {
+        return ((unsigned char)word[0] + 18 * (unsigned char)word[length - 1] + 6 * length) % KeywordHashSize;
+    }
+
+    struct KeywordTable {
+        int index[KeywordHashSize];
+        bool perfect;
+    };
+
+    constexpr KeywordTable MakeKeywordTable() {
+        KeywordTable table = {};
+        table.perfect = true;
+        for (int h = 0; h < KeywordHashSize; h++) {
+            table.index[h] = -1;
+        }
+        for (int i = 0; i < (int)(sizeof(keywords) / sizeof(keywords[0])); i++) {
+            int h = KeywordHash(keywords[i].word, keywords[i].length);
+            if (table.index[h] != -1) {
+                table.perfect = false;
+            }
+            table.index[h] = i;
+        }
+        return table;
+    }
+
+    constexpr KeywordTable keyword_table = MakeKeywordTable();
+    static_assert(keyword_table.perfect, "Keyword hash has collisions, adjust KeywordHash");
+
+    int ParseInteger(const char *begin, const char *end) {
+        // Saturates like atoi so that out of range literals keep their old value
+        bool negative = (begin != end && *begin == '-');
+        if (negative) {
+            begin++;
+        }
+        unsigned long long limit = negative ? 0x8000000000000000ULL : 0x7fffffffffffffffULL;
+        unsigned long long value = 0;
+        for (; begin != end; begin++) {
+            unsigned long long digit = *begin - '0';
+            if (value > (limit - digit) / 10) {
+                value = limit;
+            }
+            else {
+                value = value * 10 + digit;
+            }
+        }
+        return (int)(negative ? 0 - value : value);
+    }
+
+    TokenType ClassifyWord(const char *word, int length) {
+        int index = keyword_table.index[KeywordHash(word, length)];
+        if (index != -1 && keywords[index].length == length && memcmp(keywords[index].word, word, length) == 0) {
+            return keywords[index].type;
+        }
+        return TokenType::Identifier;
+    }
+}
+
+std::vector <Token> Lexer::Process(Source::Buffer &source) {
+    std::string_view str = source.View();
+    const std::string &filename = source.Filename();
+    const char *s = str.data();
+    int file = Source::AddFile(filename);
+    std::vector <unsigned int> &lines = Source::GetFile(file).lines;
     std::vector <Token> token_stream;
     int line = 0, position = 0;
     int N = str.size();
-    for (int i = 0; i < N;) {
-        if (is_reserved_word(str, "asm", i)) {
-            int line_begin = line;
-            int position_begin = position;
-            i += 3;
-            position += 3;
-            while (i < N && str[i] != '{') {
-                if (str[i] == '\n') {
-                    position = -1;
-                    line++;
-                }
-                i++;
-                position++;
+
+    auto new_line = [&](int start) {
+        line++;
+        lines.push_back(start);
+    };
+
+    auto push = [&](TokenType type, int value, int line_begin, int position_begin, int line_end, int position_end) {
+        token_stream.push_back(Token(type, value, file, lines[line_begin] + position_begin, lines[line_end] + position_end));
+    };
+
+    auto char_class = [&](int i) -> CharClass {
+        return char_table.cls[(unsigned char)s[i]];
+    };
+
+    auto scan_braces = [&](TokenType type, const char *name, int line_begin, int position_begin, int &i) {
+        while (i < N && s[i] != '{') {
+            if (s[i] == '\n') {
+                position = -1;
+                new_line(i + 1);
             }
-            if (i == N) {
-                throw AliasException("{ expected after asm", line_begin, position_begin, line, position, filename);
+            i++;
+            position++;
+        }
+        if (i == N) {
+            throw AliasException(std::string("{ expected after ") + name, line_begin, position_begin, line, position, filename);
+        }
+        position++;
+        i++;
+        int l = i;
+        while (i < N && s[i] != '}') {
+            if (s[i] == '\n') {
+                position = -1;
+                new_line(i + 1);
             }
+            i++;
             position++;
+        }
+        if (i == N) {
+            throw AliasException(std::string("} expected after ") + name, line_begin, position_begin, line, position, filename);
+        }
+        push(type, Symbols::Intern(std::string_view(s + l, i - l)), line_begin, position_begin, line, position);
+        position++;
+        i++;
+    };
+
+    for (int i = 0; i < N;) {
+        switch (char_class(i)) {
+        case CharClass::Alpha: {
+            int l = i;
             i++;
-            std::string code;
-            while (i < N && str[i] != '}') {
-                code.push_back(str[i]);
-                if (str[i] == '\n') {
-                    position = -1;
-                    line++;
-                }
-                i++;
-                position++;
+            while (i < N && (char_class(i) == CharClass::Alpha || char_class(i) == CharClass::Digit)) i++;
+            int length = i - l;
+            TokenType type = ClassifyWord(s + l, length);
+            if (type == TokenType::Asm || type == TokenType::Include) {
+                int line_begin = line;
+                int position_begin = position;
+                position += length;
+                scan_braces(type, type == TokenType::Asm ? "asm" : "include", line_begin, position_begin, i);
             }
-            if (i == N) {
-                throw AliasException("} expected after asm", line_begin, position_begin, line, position, filename);
+            else if (type == TokenType::Identifier) {
+                push(type, Symbols::Intern(std::string_view(s + l, length)), line, position, line, position + length - 1);
+                position += length;
             }
-            token_stream.push_back(Token(TokenType::Asm, code, line_begin, position_begin, line, position, filename));
-            position++;
+            else {
+                push(type, 0, line, position, line, position + length - 1);
+                position += length;
+            }
+            break;
+        }
+        case CharClass::Digit: {
+            int l = i;
             i++;
+            while (i < N && char_class(i) == CharClass::Digit) i++;
+            push(TokenType::Integer, ParseInteger(s + l, s + i), line, position, line, position + i - l - 1);
+            position += i - l;
+            break;
         }
-        else if (is_reserved_word(str, "include", i)) {
-            int line_begin = line;
-            int position_begin = position;
-            i += 7;
-            position += 7;
-            while (i < N && str[i] != '{') {
-                if (str[i] == '\n') {
-                    position = -1;
-                    line++;
-                }
+        case CharClass::Space:
+            i++;
+            position++;
+            break;
+        case CharClass::Newline:
+            i++;
+            position = 0;
+            new_line(i);
+            break;
+        case CharClass::Single:
+            push(char_table.single[(unsigned char)s[i]], 0, line, position, line, position);
+            i++;
+            position++;
+            break;
+        case CharClass::Colon:
+            if (i + 1 < N && s[i + 1] == '=') {
+                push(TokenType::Assign, 0, line, position, line, position + 1);
+                i += 2;
+                position += 2;
+            }
+            else {
+                push(TokenType::Colon, 0, line, position, line, position);
                 i++;
                 position++;
             }
-            if (i == N) {
-                throw AliasException("{ expected after include", line_begin, position_begin, line, position, filename);
+            break;
+        case CharClass::Less:
+            if (i + 1 < N && s[i + 1] == '-') {
+                push(TokenType::Move, 0, line, position, line, position + 1);
+                i += 2;
+                position += 2;
             }
-            position++;
-            i++;
-            std::string code;
-            while (i < N && str[i] != '}') {
-                code.push_back(str[i]);
-                if (str[i] == '\n') {
-                    position = -1;
-                    line++;
-                }
+            else {
+                push(TokenType::Less, 0, line, position, line, position);
                 i++;
                 position++;
             }
-            if (i == N) {
-                throw AliasException("} expected after include", line_begin, position_begin, line, position, filename);
-            }
-            token_stream.push_back(Token(TokenType::Include, code, line_begin, position_begin, line, position, filename));
-            position++;
-            i++;
-        }
-        else if (is_reserved_word(str, "int", i)) {
-            token_stream.push_back(Token(TokenType::Int, line, position, line, position + 2, filename));
-            i += 3;
-            position += 3;
-        }
-        else if (is_reserved_word(str, "ptr", i)) {
-            token_stream.push_back(Token(TokenType::Ptr, line, position, line, position + 2, filename));
-            i += 3;
-            position += 3;
-        }
-        else if (is_reserved_word(str, "if", i)) {
-            token_stream.push_back(Token(TokenType::If, line, position, line, position + 1, filename));
-            i += 2;
-            position += 2;
-        }
-        else if (is_reserved_word(str, "else", i)) {
-            token_stream.push_back(Token(TokenType::Else, line, position, line, position + 3, filename));
-            i += 4;
-            position += 4;
-        }
-        else if (is_reserved_word(str, "while", i)) {
-            token_stream.push_back(Token(TokenType::While, line, position, line, position + 4, filename));
-            i += 5;
-            position += 5;
-        }
-        else if (is_reserved_word(str, "func", i)) {
-            token_stream.push_back(Token(TokenType::Func, line, position, line, position + 3, filename));
-            i += 4;
-            position += 4;
-        }
-        else if (is_reserved_word(str, "proto", i)) {
-            token_stream.push_back(Token(TokenType::Proto, line, position, line, position + 4, filename));
-            i += 5;
-            position += 5;
-        }
-        else if (is_reserved_word(str, "def", i)) {
-            token_stream.push_back(Token(TokenType::Def, line, position, line, position + 2, filename));
-            i += 3;
-            position += 3;
-        }
-        else if (is_reserved_word(str, "const", i)) {
-            token_stream.push_back(Token(TokenType::Const, line, position, line, position + 4, filename));
-            i += 5;
-            position += 5;
-        }
-        else if (is_reserved_word(str, "assume", i)) {
-            token_stream.push_back(Token(TokenType::Assume, line, position, line, position + 5, filename));
-            i += 6;
-            position += 6;
-        }
-        else if (is_reserved_word(str, "alloc", i)) {
-            token_stream.push_back(Token(TokenType::Alloc, line, position, line, position + 4, filename));
-            i += 5;
-            position += 5;
-        }
-        else if (is_reserved_word(str, "free", i)) {
-            token_stream.push_back(Token(TokenType::Free, line, position, line, position + 3, filename));
-            i += 4;
-            position += 4;
-        }
-        else if (is_reserved_word(str, "call", i)) {
-            token_stream.push_back(Token(TokenType::Call, line, position, line, position + 3, filename));
-            i += 4;
-            position += 4;
-        }
-        else if (i + 2 <= N && str.substr(i, 2) == ":=") {
-            token_stream.push_back(Token(TokenType::Assign, line, position, line, position + 1, filename));
-            i += 2;
-            position += 2;
-        }
-        else if (i + 2 <= N && str.substr(i, 2) == "<-") {
-            token_stream.push_back(Token(TokenType::Move, line, position, line, position + 1, filename));
-            i += 2;
-            position += 2;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == ",") {
-            token_stream.push_back(Token(TokenType::Comma, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == ":") {
-            token_stream.push_back(Token(TokenType::Colon, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == ";") {
-            token_stream.push_back(Token(TokenType::Semicolon, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "{") {
-            token_stream.push_back(Token(TokenType::BraceOpen, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "}") {
-            token_stream.push_back(Token(TokenType::BraceClose, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "(") {
-            token_stream.push_back(Token(TokenType::ParenthesisOpen, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == ")") {
-            token_stream.push_back(Token(TokenType::ParenthesisClose, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "[") {
-            token_stream.push_back(Token(TokenType::BracketOpen, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "]") {
-            token_stream.push_back(Token(TokenType::BracketClose, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "$") {
-            token_stream.push_back(Token(TokenType::Dereference, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "^") {
-            token_stream.push_back(Token(TokenType::Caret, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "+") {
-            token_stream.push_back(Token(TokenType::Plus, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "-") {
-            if (i + 2 <= N && is_digit(str[i + 1]) && 
+            break;
+        case CharClass::Minus:
+            if (i + 1 < N && char_class(i + 1) == CharClass::Digit &&
                (token_stream.empty() || (token_stream.back().type != TokenType::Integer && token_stream.back().type != TokenType::Identifier))) {
                 int l = i;
                 i += 2;
-                while (i + 1 <= N && is_digit(str[i])) i++;
-                int r = i - 1;
-                token_stream.push_back(Token(TokenType::Integer, atoi(str.substr(l, r - l + 1).c_str()), line, position, line, position + r - l, filename));
-                position += r - l + 1;
+                while (i < N && char_class(i) == CharClass::Digit) i++;
+                push(TokenType::Integer, ParseInteger(s + l, s + i), line, position, line, position + i - l - 1);
+                position += i - l;
             }
             else {
-                token_stream.push_back(Token(TokenType::Minus, line, position, line, position, filename));
-                i += 1;
-                position += 1;
-            }
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "*") {
-            token_stream.push_back(Token(TokenType::Mult, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "/" && (i + 2 > N || 
-            (str.substr(i + 1, 1) != "/" && str.substr(i + 1, 1) != "*"))) {
-            token_stream.push_back(Token(TokenType::Div, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "<") {
-            token_stream.push_back(Token(TokenType::Less, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "=") {
-            token_stream.push_back(Token(TokenType::Equal, line, position, line, position, filename));
-            i += 1;
-            position += 1;
-        }
-        else if (i + 2 <= N && str.substr(i, 2) == "//") {
-            i++;
-            while(i < N && str[i] != '\n') i++;
-            i = std::min(i + 1, N);
-            position = 0;
-            line++;
-        }
-        else if (i + 2 <= N && str.substr(i, 2) == "/*") {
-            i += 2;
-            position += 2;
-            while(i + 2 <= N && str.substr(i, 2) != "*/") {
+                push(TokenType::Minus, 0, line, position, line, position);
                 i++;
                 position++;
-                if (str[i] == '\n') {
-                    position = -1;
-                    line++;
+            }
+            break;
+        case CharClass::Slash:
+            if (i + 1 < N && s[i + 1] == '/') {
+                i++;
+                while (i < N && s[i] != '\n') i++;
+                i = std::min(i + 1, N);
+                position = 0;
+                new_line(i);
+            }
+            else if (i + 1 < N && s[i + 1] == '*') {
+                i += 2;
+                position += 2;
+                while (i + 2 <= N && !(s[i] == '*' && s[i + 1] == '/')) {
+                    i++;
+                    position++;
+                    if (s[i] == '\n') {
+                        position = -1;
+                        new_line(i + 1);
+                    }
                 }
+                position += 2;
+                i = std::min(i + 2, N);
             }
-            position += 2;
-            i = std::min(i + 2, N);
-        }
-        else if (i + 1 <= N && str.substr(i, 1) == "\"") {
+            else {
+                push(TokenType::Div, 0, line, position, line, position);
+                i++;
+                position++;
+            }
+            break;
+        case CharClass::Quote: {
             i++;
             int line_begin = line;
             int position_begin = position;
             position++;
             std::string buffer;
-            while (i < N && str[i] != '\"') {
-                if (str[i] == '\\' && i + 1 < N) {
-                    bool found = false;
-                    if (str[i + 1] == '0') {
-                        buffer.push_back((char)0x0);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'a') {
-                        buffer.push_back((char)0x7);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'b') {
-                        buffer.push_back((char)0x8);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'e') {
-                        buffer.push_back((char)0x1B);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'f') {
-                        buffer.push_back((char)0xC);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'n') {
-                        buffer.push_back((char)0xA);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'r') {
-                        buffer.push_back((char)0xD);
-                        found = true;
-                    }
-                    if (str[i + 1] == 't') {
-                        buffer.push_back((char)0x9);
-                        found = true;
-                    }
-                    if (str[i + 1] == 'v') {
-                        buffer.push_back((char)0xB);
-                        found = true;
-                    }
-                    if (str[i + 1] == '\\') {
-                        buffer.push_back((char)0x5C);
-                        found = true;
-                    }
-                    if (str[i + 1] == '\'') {
-                        buffer.push_back((char)0x27);
-                        found = true;
-                    }
-                    if (str[i + 1] == '\"') {
-                        buffer.push_back((char)0x22);
-                        found = true;
-                    }
-                    if (str[i + 1] == '?') {
-                        buffer.push_back((char)0x3F);
-                        found = true;
-                    }
-                    if (found) {
-                        i += 2;
-                        position += 2;
-                        continue;
-                    }
+            while (i < N && s[i] != '\"') {
+                if (s[i] == '\\' && i + 1 < N && char_table.escape[(unsigned char)s[i + 1]] != -1) {
+                    buffer.push_back((char)char_table.escape[(unsigned char)s[i + 1]]);
+                    i += 2;
+                    position += 2;
+                    continue;
                 }
-                buffer.push_back(str[i]);
-                if (str[i] == '\n') {
+                buffer.push_back(s[i]);
+                if (s[i] == '\n') {
                     position = -1;
-                    line++;
+                    new_line(i + 1);
                 }
                 i++;
                 position++;
@@ -365,41 +342,17 @@ std::vector <Token> Lexer::Process(std::string str, std::string filename) {
                 throw AliasException("\" expected after string", line_begin, position_begin, line, position, filename);
             }
             buffer.push_back('\0');
-            token_stream.push_back(Token(TokenType::String, buffer, line_begin, position_begin, line, position, filename));
-            position++;
-            i++;
-        }
-        else if (is_digit(str[i])) {
-            int l = i;
-            i++;
-            while (i + 1 <= N && is_digit(str[i])) i++;
-            int r = i - 1;
-            token_stream.push_back(Token(TokenType::Integer, atoi(str.substr(l, r - l + 1).c_str()), line, position, line, position + r - l, filename));
-            position += r - l + 1;
-        }
-        else if (is_alpha(str[i])) {
-            int l = i;
-            i++;
-            while (i + 1 <= N && (is_alpha(str[i]) || is_digit(str[i]))) i++;
-            int r = i - 1;
-            token_stream.push_back(Token(TokenType::Identifier, str.substr(l, r - l + 1), line, position, line, position + r - l, filename));
-            position += r - l + 1;
-        }
-        else if (str[i] == ' ' || str[i] == '\t') {
-            i++;
+            push(TokenType::String, Symbols::Intern(buffer), line_begin, position_begin, line, position);
             position++;
-        }
-        else if (str[i] == '\n') {
             i++;
-            position = 0;
-            line++;
+            break;
         }
-        else {
+        default:
             throw AliasException("Unexpected symbol", line, position, line, position, filename);
         }
     }
 
-    token_stream.push_back(Token(TokenType::Eof, line, position, line, position, filename));
+    push(TokenType::Eof, 0, line, position, line, position);
 
     return token_stream;
-}
\ No newline at end of file
+}
@@ -4,9 +4,10 @@
 #include <string>
 #include <vector>
 #include "token.h"
+#include "source.h"
 
 namespace Lexer {
-    std::vector <Token> Process(std::string str, std::string filename);
+    std::vector <Token> Process(Source::Buffer &source);
 }
 
 #endif // LEXER_H_INCLUDED
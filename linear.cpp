@@ -0,0 +1,172 @@
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "linear.h"
+#include "state.h"
+
+namespace Linear {
+    // constant plus the sum of coefficient * metavariable over terms, which
+    // are sorted by symbol and have nonzero coefficients.
+    struct Expression {
+        long long constant = 0;
+        std::vector <std::pair <int, long long>> terms;
+
+        bool operator <(const Expression &other) const {
+            if (constant != other.constant) {
+                return constant < other.constant;
+            }
+            return terms < other.terms;
+        }
+    };
+
+    std::deque <Expression> expressions;
+    std::map <Expression, int> index;
+    std::mutex mutex;
+
+    const long long unbounded = AST::unbounded_offset;
+
+    int Make(const Expression &expression) {
+        if (expression.terms.empty()) {
+            if (expression.constant <= -unbounded || expression.constant >= unbounded) {
+                throw Failure();
+            }
+            return (int)expression.constant;
+        }
+        // Keeps every value the expression takes inside the offset range,
+        // so that offsets never saturate in the instances either.
+        long long extent = std::abs(expression.constant);
+        for (auto &term : expression.terms) {
+            if (std::abs(term.second) >= unbounded) {
+                throw Failure();
+            }
+            extent += std::abs(term.second) * max_variable;
+            if (extent >= unbounded) {
+                throw Failure();
+            }
+        }
+        std::lock_guard <std::mutex> lock(mutex);
+        auto it = index.find(expression);
+        if (it != index.end()) {
+            return it->second;
+        }
+        int id = symbolic_base + (int)expressions.size();
+        expressions.push_back(expression);
+        index.emplace(expression, id);
+        return id;
+    }
+
+    Expression Get(int value) {
+        if (!IsSymbolic(value)) {
+            Expression expression;
+            expression.constant = value;
+            return expression;
+        }
+        std::lock_guard <std::mutex> lock(mutex);
+        return expressions[value - symbolic_base];
+    }
+
+    // a + factor * b.
+    Expression Combine(const Expression &a, const Expression &b, long long factor) {
+        Expression result;
+        result.constant = a.constant + factor * b.constant;
+        size_t i = 0, j = 0;
+        while (i < a.terms.size() || j < b.terms.size()) {
+            if (j == b.terms.size() || (i < a.terms.size() && a.terms[i].first < b.terms[j].first)) {
+                result.terms.push_back(a.terms[i++]);
+            }
+            else if (i == a.terms.size() || b.terms[j].first < a.terms[i].first) {
+                result.terms.push_back({b.terms[j].first, factor * b.terms[j].second});
+                j++;
+            }
+            else {
+                long long coefficient = a.terms[i].second + factor * b.terms[j].second;
+                if (coefficient != 0) {
+                    result.terms.push_back({a.terms[i].first, coefficient});
+                }
+                i++;
+                j++;
+            }
+        }
+        return result;
+    }
+
+    bool IsUnbounded(int value) {
+        return value == -unbounded || value == unbounded;
+    }
+
+    int Variable(int symbol) {
+        Expression expression;
+        expression.terms.push_back({symbol, 1});
+        return Make(expression);
+    }
+
+    int Add(int a, int b) {
+        if (IsUnbounded(a) || IsUnbounded(b)) {
+            if (IsUnbounded(a) && IsUnbounded(b) && a != b) {
+                throw Failure();
+            }
+            return IsUnbounded(a) ? a : b;
+        }
+        return Make(Combine(Get(a), Get(b), 1));
+    }
+
+    int Subtract(int a, int b) {
+        if (IsUnbounded(b)) {
+            return Add(a, -b);
+        }
+        return Add(a, Make(Combine(Expression(), Get(b), -1)));
+    }
+
+    int Multiply(int a, int b) {
+        if (IsUnbounded(a) || IsUnbounded(b) || (IsSymbolic(a) && IsSymbolic(b))) {
+            throw Failure();
+        }
+        if (IsSymbolic(a)) {
+            std::swap(a, b);
+        }
+        return Make(Combine(Expression(), Get(b), a));
+    }
+
+    bool ProvenLessEqual(int a, int b) {
+        if (!IsSymbolic(a) && !IsSymbolic(b)) {
+            return a <= b;
+        }
+        if (a == b || a == -unbounded || b == unbounded) {
+            return true;
+        }
+        if (a == unbounded || b == -unbounded) {
+            return false;
+        }
+        // b - a = c + sum k_i m_i is smallest with m_i = 1 where k_i is
+        // nonnegative and m_i = max_variable where it is negative.
+        Expression difference = Combine(Get(b), Get(a), -1);
+        long long lowest = difference.constant;
+        for (auto &term : difference.terms) {
+            lowest += term.second * (term.second < 0 ? max_variable : 1);
+        }
+        return lowest >= 0;
+    }
+
+    int Min(int a, int b) {
+        if (ProvenLessEqual(a, b)) {
+            return a;
+        }
+        if (ProvenLessEqual(b, a)) {
+            return b;
+        }
+        throw Failure();
+    }
+
+    int Max(int a, int b) {
+        if (ProvenLessEqual(a, b)) {
+            return b;
+        }
+        if (ProvenLessEqual(b, a)) {
+            return a;
+        }
+        throw Failure();
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef LINEAR_H_INCLUDED
+#define LINEAR_H_INCLUDED
+
+#include <exception>
+
+// Values linear in the metavariables of a function, used to validate the
+// function once for all of their values. A value is a plain integer or,
+// from symbolic_base up, the id of an interned expression with at least one
+// metavariable term. Expressions that fold to a constant are always given as
+// the plain integer, so equal values have equal representations. Every
+// metavariable is taken to be between 1 and max_variable.
+namespace Linear {
+    const int symbolic_base = 1 << 30;
+    const int max_variable = 1 << 16;
+
+    // Thrown when a value would stop being linear, or could leave the
+    // offset range for some value of the metavariables.
+    class Failure : public std::exception {
+    };
+
+    inline bool IsSymbolic(int value) {
+        return value >= symbolic_base;
+    }
+
+    // The metavariable with the given symbol id.
+    int Variable(int symbol);
+    // Sums saturate at the unbounded offset, see state.h.
+    int Add(int a, int b);
+    int Subtract(int a, int b);
+    int Multiply(int a, int b);
+    // Whether a <= b for every value of the metavariables.
+    bool ProvenLessEqual(int a, int b);
+    // Throw Failure if the order of a and b depends on the metavariables.
+    int Min(int a, int b);
+    int Max(int a, int b);
+}
+
+#endif // LINEAR_H_INCLUDED
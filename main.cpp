@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <iostream>
 
 #include "process.h"
@@ -11,6 +12,13 @@ void help() {
     std::cout << "  -a        Compile program and assemble it using nasm to object file.\n";
     std::cout << "  -l        Compile, assemble and link program using gcc to executable file.\n";
     std::cout << "  -m        Disable top level main function.\n";
+    std::cout << "  -i        Include every file at most once.\n";
+    std::cout << "  -r        Print include cache, AST memory and instance statistics, and the values of constant expressions.\n";
+    std::cout << "  -u        Merge validator states that differ in one pointer being null.\n";
+    std::cout << "  -d        Keep validator states in decision diagrams.\n";
+    std::cout << "  -b        Set the number of iterations the check of a while loop may take. Number has to follow this flag.\n";
+    std::cout << "  -j        Validate using several threads. Number of threads has to follow this flag.\n";
+    std::cout << "  -p        Cache parsed files and validated functions in a directory. Directory name has to follow this flag.\n";
     std::cout << "  -o        Set output file name. File name has to follow this flag.\n";
 }
 
@@ -37,6 +45,43 @@ int main(int argc, char *argv[]) {
             else if (arg == "-m") {
                 Settings::SetTopMain(true);
             }
+            else if (arg == "-i") {
+                Settings::SetIncludeOnce(true);
+            }
+            else if (arg == "-r") {
+                Settings::SetReport(true);
+            }
+            else if (arg == "-u") {
+                Settings::SetSubsumption(true);
+            }
+            else if (arg == "-d") {
+                Settings::SetDiagrams(true);
+            }
+            else if (arg == "-b") {
+                if (i + 1 == argc || std::atoi(argv[i + 1]) < 1) {
+                    std::cout << "Number of iterations has to be specified after -b flag" << std::endl;
+                    return 1;
+                }
+                Settings::SetLoopBudget(std::atoi(argv[i + 1]));
+                i++;
+            }
+            else if (arg == "-j") {
+                if (i + 1 == argc || std::atoi(argv[i + 1]) < 1) {
+                    std::cout << "Number of threads has to be specified after -j flag" << std::endl;
+                    return 1;
+                }
+                Settings::SetJobs(std::atoi(argv[i + 1]));
+                i++;
+            }
+            else if (arg == "-p") {
+                if (i + 1 == argc) {
+                    std::cout << "Directory has to be specified after -p flag" << std::endl;
+                    return 1;
+                }
+                std::string str(argv[i + 1]);
+                Settings::SetCacheDirectory(str);
+                i++;
+            }
             else if (arg == "-o") {
                 if (i + 1 == argc) {
                     std::cout << "Filename has to be specified after -o flag" << std::endl;
@@ -1,6 +1,5 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
 
 #include "lexer.h"
 #include "syntax.h"
@@ -9,20 +8,36 @@
 #include "exception.h"
 #include "settings.h"
 #include "process.h"
+#include "include.h"
+#include "astcache.h"
+#include "resolve.h"
 
-std::shared_ptr <AST::Node> Parse(std::string filename) {
-    std::ifstream fin(filename);
-    if (!fin) {
+AST::Node *Parse(std::string filename) {
+    AST::Node *node;
+    std::vector <Syntax::Splice> splices;
+    if (Include::Take(filename, node, splices)) {
+        try {
+            Syntax::Link(splices);
+        }
+        catch (AliasException &ex) {
+            std::cout << "Error" << std::endl;
+            std::cout << ex.filename << std::endl;
+            std::cout << ex.line_begin + 1 << ':' << ex.position_begin + 1 << '-' << ex.line_end + 1 << ':' << ex.position_end + 1 << std::endl;
+            std::cout << "Syntax Error: " << ex.value << std::endl;
+            exit(1);
+        }
+        return node;
+    }
+
+    Source::Buffer source(filename);
+    if (!source.Good()) {
         std::cerr << "Could not open file " << filename << "\n";
         exit(1);
     }
 
-    std::stringstream buffer;
-    buffer << fin.rdbuf();
     std::vector <Token> token_stream;
-    std::shared_ptr <AST::Node> node;
     try {
-        token_stream = Lexer::Process(buffer.str(), filename);
+        token_stream = Lexer::Process(source);
     }
     catch (AliasException &ex) {
         std::cout << "Error" << std::endl;
@@ -47,13 +62,28 @@ std::shared_ptr <AST::Node> Parse(std::string filename) {
 }
 
 int Process() {
-    std::shared_ptr <AST::Node> node = Parse(Settings::GetFilename());
+    Include::Preload(Settings::GetFilename());
+    AST::Node *node = Parse(Settings::GetFilename());
+    if (Settings::GetReport()) {
+        Include::PrintStatistics();
+        AST::PrintMemory();
+    }
 
     try {
+        AST::Resolve(node);
         AST::Validate(node);
         if (Settings::GetStates()) {
             AST::PrintStatesLog();
         }
+        if (Settings::GetReport()) {
+            AST::PrintEvaluations();
+            if (Settings::GetJobs() > 1) {
+                AST::PrintInstances();
+            }
+            if (!Settings::GetCacheDirectory().empty()) {
+                ASTCache::PrintSummaryStatistics();
+            }
+        }
     }
     catch (AliasException &ex) {
         std::cout << "Error" << std::endl;
@@ -116,5 +146,6 @@ int Process() {
         }
     }
 
+    AST::FreeNodes();
     return 0;
 }
@@ -4,7 +4,7 @@
 #include <string>
 #include "ast.h"
 
-std::shared_ptr <AST::Node> Parse(std::string filename);
+AST::Node *Parse(std::string filename);
 int Process();
 
 #endif // PROCESS_H_INCLUDED
\ No newline at end of file
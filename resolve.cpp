@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <unordered_set>
+#include "ast.h"
+#include "resolve.h"
+#include "state.h"
+
+namespace AST {
+
+// Names visible while walking the program. Like the variable stacks of
+// both backends, variables restart at each function: its arguments come
+// first, then its locals in definition order. Functions stay visible in
+// the bodies of the functions defined after them.
+struct RSContext {
+    std::vector <int> variable_stack;
+    std::vector <int> function_stack;
+    std::vector <int> metavariables;
+    int argument_count = 0;
+    // Included files are parsed once and their nodes shared between every
+    // block that includes them. A name that resolves differently in two of
+    // them is left to the backends to look up.
+    std::unordered_set <const Node*> visited;
+};
+
+void bind(int &field, int value, bool first) {
+    if (first) {
+        field = value;
+    }
+    else if (field != value) {
+        field = -1;
+    }
+}
+
+int findVariable(int id, RSContext &context) {
+    for (int i = (int)context.variable_stack.size() - 1; i >= 0; i--) {
+        if (context.variable_stack[i] == id) {
+            // The code generator looks arguments up from the first one,
+            // after the metavariables, and the validator from the last one,
+            // so a name they share is left to both.
+            auto begin = context.variable_stack.begin();
+            if (i < context.argument_count &&
+                (std::find(begin, begin + i, id) != begin + i ||
+                 std::find(context.metavariables.begin(), context.metavariables.end(), id) != context.metavariables.end())) {
+                return -1;
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+int findFunction(int id, RSContext &context) {
+    for (int i = (int)context.function_stack.size() - 1; i >= 0; i--) {
+        if (context.function_stack[i] == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::vector <Expression*> folded_expressions;
+
+// Folds an operation whose operands are folded, see Expression in ast.h.
+// Operations are listed in folded_expressions in place of their operands.
+void foldNode(Expression *expression) {
+    if (expression->folded) {
+        return;
+    }
+    long long value;
+    if (auto _integer = As <Integer> (expression)) {
+        value = _integer->value;
+    }
+    else {
+        BinaryOperation *operation = static_cast <BinaryOperation*> (expression);
+        if (!operation->left->folded || !operation->right->folded) {
+            return;
+        }
+        long long left = operation->left->folded_value, right = operation->right->folded_value;
+        switch (expression->kind) {
+        case Kind::Addition:
+            value = left + right;
+            break;
+        case Kind::Subtraction:
+            value = left - right;
+            break;
+        case Kind::Multiplication:
+            value = left * right;
+            break;
+        case Kind::Division:
+            if (right == 0) {
+                return;
+            }
+            value = left / right;
+            break;
+        case Kind::Less:
+            value = left < right;
+            break;
+        default:
+            value = left == right;
+            break;
+        }
+    }
+    if (value <= -unbounded_offset || value >= unbounded_offset) {
+        return;
+    }
+    expression->folded = true;
+    expression->folded_value = (int)value;
+    if (expression->kind != Kind::Integer) {
+        BinaryOperation *operation = static_cast <BinaryOperation*> (expression);
+        if (!folded_expressions.empty() && folded_expressions.back() == operation->right) {
+            folded_expressions.pop_back();
+        }
+        if (!folded_expressions.empty() && folded_expressions.back() == operation->left) {
+            folded_expressions.pop_back();
+        }
+        folded_expressions.push_back(expression);
+    }
+}
+
+// Folds the expressions of signatures and invariants, which only use
+// metavariables and are not resolved.
+void fold(Expression *expression) {
+    if (!expression) {
+        return;
+    }
+    switch (expression->kind) {
+    case Kind::Integer:
+        foldNode(expression);
+        break;
+    case Kind::Addition:
+    case Kind::Subtraction:
+    case Kind::Multiplication:
+    case Kind::Division:
+    case Kind::Less:
+    case Kind::Equal: {
+        BinaryOperation *operation = static_cast <BinaryOperation*> (expression);
+        fold(operation->left);
+        fold(operation->right);
+        foldNode(expression);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void foldSignature(FunctionSignature *signature) {
+    for (Expression *expression : signature->size_in) {
+        fold(expression);
+    }
+    for (Expression *expression : signature->size_out) {
+        fold(expression);
+    }
+}
+
+void resolve(Node *node, RSContext &context) {
+    if (!node) {
+        return;
+    }
+    bool first = context.visited.insert(node).second;
+    switch (node->kind) {
+    case Kind::Block: {
+        Block *block = static_cast <Block*> (node);
+        size_t old_variable_stack_size = context.variable_stack.size();
+        size_t old_function_stack_size = context.function_stack.size();
+        for (Statement *statement : block->statement_list) {
+            resolve(statement, context);
+        }
+        context.variable_stack.resize(old_variable_stack_size);
+        context.function_stack.resize(old_function_stack_size);
+        break;
+    }
+    case Kind::If: {
+        If *_if = static_cast <If*> (node);
+        for (auto &branch : _if->branch_list) {
+            resolve(branch.first, context);
+            resolve(branch.second, context);
+        }
+        resolve(_if->else_body, context);
+        break;
+    }
+    case Kind::While: {
+        While *_while = static_cast <While*> (node);
+        resolve(_while->expression, context);
+        for (InvariantClause &clause : _while->invariant) {
+            fold(clause.low);
+            fold(clause.high);
+        }
+        resolve(_while->block, context);
+        break;
+    }
+    case Kind::FunctionDefinition: {
+        FunctionDefinition *function = static_cast <FunctionDefinition*> (node);
+        context.function_stack.push_back(function->name);
+        foldSignature(function->signature);
+        RSContext _context;
+        _context.function_stack = context.function_stack;
+        _context.variable_stack = function->signature->identifiers;
+        _context.metavariables = function->metavariables;
+        _context.argument_count = (int)function->signature->identifiers.size();
+        std::swap(_context.visited, context.visited);
+        resolve(function->body, _context);
+        std::swap(_context.visited, context.visited);
+        break;
+    }
+    case Kind::Prototype: {
+        Prototype *prototype = static_cast <Prototype*> (node);
+        context.function_stack.push_back(prototype->name);
+        foldSignature(prototype->signature);
+        break;
+    }
+    case Kind::Definition:
+        context.variable_stack.push_back(static_cast <Definition*> (node)->identifier);
+        break;
+    case Kind::Assignment: {
+        Assignment *assignment = static_cast <Assignment*> (node);
+        bind(assignment->variable, findVariable(assignment->identifier, context), first);
+        resolve(assignment->value, context);
+        break;
+    }
+    case Kind::Movement: {
+        Movement *movement = static_cast <Movement*> (node);
+        bind(movement->variable, findVariable(movement->identifier, context), first);
+        resolve(movement->value, context);
+        break;
+    }
+    case Kind::MovementString: {
+        MovementString *movement = static_cast <MovementString*> (node);
+        bind(movement->variable, findVariable(movement->identifier, context), first);
+        break;
+    }
+    case Kind::Assumption: {
+        Assumption *assumption = static_cast <Assumption*> (node);
+        bind(assumption->variable, findVariable(assumption->identifier, context), first);
+        resolve(assumption->left, context);
+        resolve(assumption->right, context);
+        resolve(assumption->statement, context);
+        break;
+    }
+    case Kind::Identifier: {
+        Identifier *identifier = static_cast <Identifier*> (node);
+        bind(identifier->variable, findVariable(identifier->identifier, context), first);
+        break;
+    }
+    case Kind::Alloc:
+        resolve(static_cast <Alloc*> (node)->expression, context);
+        break;
+    case Kind::Free:
+        resolve(static_cast <Free*> (node)->arg, context);
+        break;
+    case Kind::FunctionCall: {
+        FunctionCall *call = static_cast <FunctionCall*> (node);
+        bind(call->function, findFunction(call->identifier, context), first);
+        if (first) {
+            call->argument_variables.assign(call->arguments.size(), -1);
+        }
+        for (size_t i = 0; i < call->arguments.size(); i++) {
+            bind(call->argument_variables[i], findVariable(call->arguments[i], context), first);
+        }
+        for (auto &p : call->metavariables) {
+            resolve(p.second, context);
+        }
+        break;
+    }
+    case Kind::Dereference:
+        resolve(static_cast <Dereference*> (node)->arg, context);
+        break;
+    case Kind::Addition:
+    case Kind::Subtraction:
+    case Kind::Multiplication:
+    case Kind::Division:
+    case Kind::Less:
+    case Kind::Equal: {
+        BinaryOperation *operation = static_cast <BinaryOperation*> (node);
+        resolve(operation->left, context);
+        resolve(operation->right, context);
+        foldNode(operation);
+        break;
+    }
+    case Kind::Integer:
+        foldNode(static_cast <Integer*> (node));
+        break;
+    case Kind::Asm:
+        break;
+    }
+}
+
+void Resolve(Node *node) {
+    RSContext context;
+    resolve(node, context);
+}
+
+const std::vector <Expression*> &FoldedExpressions() {
+    return folded_expressions;
+}
+
+}
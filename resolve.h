@@ -0,0 +1,16 @@
+#ifndef RESOLVE_H_INCLUDED
+#define RESOLVE_H_INCLUDED
+
+#include "ast.h"
+
+namespace AST {
+    // Binds the names used in the program to the indices of their
+    // definitions, see the variable and function fields in ast.h, and
+    // folds constant expressions, see Expression.
+    void Resolve(Node *node);
+    // Operations folded by Resolve that are not part of a larger folded
+    // one, in program order.
+    const std::vector <Expression*> &FoldedExpressions();
+}
+
+#endif // RESOLVE_H_INCLUDED
@@ -6,8 +6,16 @@ namespace Settings {
     bool Assemble = false;
     bool Link = false;
     bool TopMain = false;
+    bool IncludeOnce = false;
+    bool Report = false;
+    bool Subsumption = false;
+    bool Diagrams = false;
+    // Iterations the check of a while loop may take, 99 as it always was.
+    int LoopBudget = 99;
+    int Jobs = 1;
     std::string Filename;
     std::string OutputFilename;
+    std::string CacheDirectory;
 
     bool GetStates() {
         return States;
@@ -49,6 +57,62 @@ namespace Settings {
         TopMain = state;
     }
 
+    bool GetIncludeOnce() {
+        return IncludeOnce;
+    }
+
+    void SetIncludeOnce(bool state) {
+        IncludeOnce = state;
+    }
+
+    bool GetReport() {
+        return Report;
+    }
+
+    void SetReport(bool state) {
+        Report = state;
+    }
+
+    bool GetSubsumption() {
+        return Subsumption;
+    }
+
+    void SetSubsumption(bool state) {
+        Subsumption = state;
+    }
+
+    bool GetDiagrams() {
+        return Diagrams;
+    }
+
+    void SetDiagrams(bool state) {
+        Diagrams = state;
+    }
+
+    int GetLoopBudget() {
+        return LoopBudget;
+    }
+
+    void SetLoopBudget(int state) {
+        LoopBudget = state;
+    }
+
+    int GetJobs() {
+        return Jobs;
+    }
+
+    void SetJobs(int state) {
+        Jobs = state;
+    }
+
+    std::string GetCacheDirectory() {
+        return CacheDirectory;
+    }
+
+    void SetCacheDirectory(std::string state) {
+        CacheDirectory = state;
+    }
+
     std::string GetFilename() {
         return Filename;
     }
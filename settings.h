@@ -14,6 +14,20 @@ namespace Settings {
     void SetLink(bool state);
     bool GetTopMain();
     void SetTopMain(bool state);
+    bool GetIncludeOnce();
+    void SetIncludeOnce(bool state);
+    bool GetReport();
+    void SetReport(bool state);
+    bool GetSubsumption();
+    void SetSubsumption(bool state);
+    bool GetDiagrams();
+    void SetDiagrams(bool state);
+    int GetLoopBudget();
+    void SetLoopBudget(int state);
+    int GetJobs();
+    void SetJobs(int state);
+    std::string GetCacheDirectory();
+    void SetCacheDirectory(std::string state);
     std::string GetFilename();
     void SetFilename(std::string state);
     std::string GetOutputFilename();
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+#include "exception.h"
+
+namespace Source {
+    Buffer::Buffer(std::string _filename) {
+        filename = _filename;
+        data = nullptr;
+        size = 0;
+        mapped = false;
+        good = false;
+
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return;
+        }
+        good = true;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+                data = (const char*)ptr;
+                size = st.st_size;
+                mapped = true;
+            }
+        }
+        close(fd);
+        if (!mapped) {
+            std::ifstream fin(filename);
+            std::stringstream buffer;
+            buffer << fin.rdbuf();
+            fallback = buffer.str();
+            data = fallback.data();
+            size = fallback.size();
+        }
+    }
+
+    Buffer::~Buffer() {
+        if (mapped) {
+            munmap((void*)data, size);
+        }
+    }
+
+    // Files are registered from the include parsing threads. The deque keeps
+    // references stable, the mutex protects its index.
+    std::deque <File> files;
+    std::mutex files_mutex;
+
+    int AddFile(std::string filename) {
+        std::lock_guard <std::mutex> lock(files_mutex);
+        if ((int)files.size() == max_files) {
+            throw AliasException("Too many source files", 0, 0, 0, 0, filename);
+        }
+        files.push_back(File());
+        files.back().filename = filename;
+        files.back().lines.push_back(0);
+        return (int)files.size() - 1;
+    }
+
+    File &GetFile(int id) {
+        std::lock_guard <std::mutex> lock(files_mutex);
+        return files[id];
+    }
+
+    void Locate(int id, unsigned int offset, int &line, int &position) {
+        Locate(GetFile(id).lines, offset, line, position);
+    }
+
+    void Locate(const std::vector <unsigned int> &lines, unsigned int offset, int &line, int &position) {
+        line = (int)(std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin()) - 1;
+        position = (int)(offset - lines[line]);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef SOURCE_H_INCLUDED
+#define SOURCE_H_INCLUDED
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Source {
+    class Buffer {
+    private:
+        std::string filename;
+        const char *data;
+        size_t size;
+        bool mapped;
+        bool good;
+        std::string fallback;
+    public:
+        Buffer(std::string _filename);
+        ~Buffer();
+        Buffer(const Buffer&) = delete;
+        Buffer &operator=(const Buffer&) = delete;
+
+        bool Good() const {
+            return good;
+        }
+
+        const std::string &Filename() const {
+            return filename;
+        }
+
+        std::string_view View() const {
+            return std::string_view(data, size);
+        }
+    };
+
+    struct File {
+        std::string filename;
+        std::vector <unsigned int> lines;
+    };
+
+    // Every lexed or cached file gets an id, re-parses included. Ids have
+    // to fit in Token::file.
+    const int max_files = 1 << 24;
+    int AddFile(std::string filename);
+    File &GetFile(int id);
+    void Locate(int id, unsigned int offset, int &line, int &position);
+    // The same given the line table of the file, which needs no lock.
+    void Locate(const std::vector <unsigned int> &lines, unsigned int offset, int &line, int &position);
+}
+
+#endif // SOURCE_H_INCLUDED
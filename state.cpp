@@ -0,0 +1,806 @@
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "linear.h"
+#include "state.h"
+
+namespace AST {
+    const int chunk_bits = 4;
+    const int chunk_size = 1 << chunk_bits;
+    const Slot null_slot = {-1, 0};
+
+    typedef std::array <Slot, chunk_size> Chunk;
+
+    struct Spine {
+        std::vector <int> chunks;
+        int size;
+
+        bool operator ==(const Spine &other) const {
+            return size == other.size && chunks == other.chunks;
+        }
+    };
+
+    uint64_t Avalanche(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    uint64_t HashOf(const Chunk &chunk) {
+        uint64_t hash = 0;
+        for (const Slot &slot : chunk) {
+            hash = Avalanche(hash ^ (((uint64_t)(uint32_t)slot.first << 32) | (uint32_t)slot.second) ^
+                (uint64_t)(uint32_t)(slot.last - slot.second) * 0x9E3779B97F4A7C15ull);
+        }
+        return hash;
+    }
+
+    // Array growing in fixed-size segments that never move, so elements can
+    // be read while other threads append. Elements start value-initialized.
+    template <class T>
+    class Segmented {
+    public:
+        T &operator [](int i) const {
+            return segments[i >> segment_bits].load(std::memory_order_acquire)[i & (segment_size - 1)];
+        }
+
+        // Makes sure element i exists.
+        void Reserve(int i) {
+            std::atomic <T*> &segment = segments[i >> segment_bits];
+            if (segment.load(std::memory_order_acquire)) {
+                return;
+            }
+            T *fresh = new T[segment_size]();
+            T *expected = nullptr;
+            if (!segment.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)) {
+                delete[] fresh;
+            }
+        }
+
+    private:
+        static constexpr int segment_bits = 12;
+        static constexpr int segment_size = 1 << segment_bits;
+        static constexpr int max_segments = 1 << 16;
+
+        std::atomic <T*> segments[max_segments] = {};
+    };
+
+    // Stores every distinct value once and hands out dense ids. Values live
+    // in a segmented array and are read without locking. The index is split
+    // into shards by hash, each an open-addressing table of ids with linear
+    // probing under its own mutex, so threads interning different values
+    // rarely wait for each other. The hash of each value is computed by the
+    // caller and kept next to it.
+    template <class T>
+    class Interner {
+    public:
+        int Intern(const T &value, uint64_t hash) {
+            Shard &shard = shards[hash >> (64 - shard_bits)];
+            std::lock_guard <std::mutex> lock(shard.mutex);
+            if ((shard.count + 1) * 2 > (int)shard.index.size()) {
+                Grow(shard);
+            }
+            size_t mask = shard.index.size() - 1;
+            for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+                int id = shard.index[i];
+                if (id == -1) {
+                    id = next_id++;
+                    entries.Reserve(id);
+                    entries[id] = {value, hash};
+                    shard.index[i] = id;
+                    shard.count++;
+                    return id;
+                }
+                if (entries[id].hash == hash && entries[id].value == value) {
+                    return id;
+                }
+            }
+        }
+
+        // Returns the id of value, or -1 if it was never interned.
+        int Find(const T &value, uint64_t hash) {
+            Shard &shard = shards[hash >> (64 - shard_bits)];
+            std::lock_guard <std::mutex> lock(shard.mutex);
+            if (shard.index.empty()) {
+                return -1;
+            }
+            size_t mask = shard.index.size() - 1;
+            for (size_t i = hash & mask; shard.index[i] != -1; i = (i + 1) & mask) {
+                int id = shard.index[i];
+                if (entries[id].hash == hash && entries[id].value == value) {
+                    return id;
+                }
+            }
+            return -1;
+        }
+
+        const T &Get(int id) const {
+            return entries[id].value;
+        }
+
+        uint64_t Hash(int id) const {
+            return entries[id].hash;
+        }
+
+    private:
+        static constexpr int shard_bits = 6;
+
+        struct Entry {
+            T value;
+            uint64_t hash;
+        };
+
+        struct Shard {
+            std::mutex mutex;
+            std::vector <int> index;
+            int count = 0;
+        };
+
+        Segmented <Entry> entries;
+        Shard shards[1 << shard_bits];
+        std::atomic <int> next_id{0};
+
+        void Grow(Shard &shard) {
+            std::vector <int> old_index;
+            old_index.swap(shard.index);
+            shard.index.assign(std::max(old_index.size() * 2, (size_t)64), -1);
+            size_t mask = shard.index.size() - 1;
+            for (int id : old_index) {
+                if (id == -1) {
+                    continue;
+                }
+                size_t i = entries[id].hash & mask;
+                while (shard.index[i] != -1) {
+                    i = (i + 1) & mask;
+                }
+                shard.index[i] = id;
+            }
+        }
+    };
+
+    // A chunk with its distinct packets in order of first reference, and
+    // the id of the chunk with every offset range set to 0..0, or -1 if that
+    // is the chunk itself. Slots past the end of the heap are null, so the
+    // whole chunk is scanned.
+    struct ChunkData {
+        Chunk slots;
+        int count;
+        std::array <int, chunk_size> packets;
+        int shape;
+
+        bool operator ==(const ChunkData &other) const {
+            return slots == other.slots;
+        }
+    };
+
+    Interner <ChunkData> chunks;
+    Interner <Spine> spines;
+    // Distinct packets of each heap in order of first reference, filled on
+    // first use and never changed after.
+    Segmented <std::atomic <const std::vector <int>*>> spine_packets;
+
+    struct Packets {
+        const int *first, *last;
+
+        const int *begin() const {
+            return first;
+        }
+
+        const int *end() const {
+            return last;
+        }
+    };
+
+    int InternChunk(const Chunk &chunk) {
+        ChunkData data;
+        data.slots = chunk;
+        uint64_t hash = HashOf(chunk);
+        int id = chunks.Find(data, hash);
+        if (id != -1) {
+            return id;
+        }
+        data.count = 0;
+        bool ranged = false;
+        for (const Slot &slot : chunk) {
+            if (slot.first != -1 && std::find(data.packets.begin(), data.packets.begin() + data.count, slot.first) == data.packets.begin() + data.count) {
+                data.packets[data.count++] = slot.first;
+            }
+            ranged |= slot.second != 0 || slot.last != 0;
+        }
+        data.shape = -1;
+        if (ranged) {
+            Chunk shape = chunk;
+            for (Slot &slot : shape) {
+                slot.second = slot.last = 0;
+            }
+            data.shape = InternChunk(shape);
+        }
+        return chunks.Intern(data, hash);
+    }
+
+    const Chunk &ChunkSlots(int chunk) {
+        return chunks.Get(chunk).slots;
+    }
+
+    Packets ChunkPackets(int chunk) {
+        const ChunkData &data = chunks.Get(chunk);
+        return {data.packets.data(), data.packets.data() + data.count};
+    }
+
+    Packets SpinePackets(int spine) {
+        spine_packets.Reserve(spine);
+        const std::vector <int> *packets = spine_packets[spine].load(std::memory_order_acquire);
+        if (!packets) {
+            thread_local std::vector <int> stamp;
+            thread_local int generation = 0;
+            generation++;
+            std::vector <int> *list = new std::vector <int> ();
+            for (int chunk : spines.Get(spine).chunks) {
+                for (int packet : ChunkPackets(chunk)) {
+                    // Pointers and maybe-null pointers into one packet are
+                    // kept apart.
+                    int key = packet >= 0 ? 2 * packet : 2 * PacketOf(packet) + 1;
+                    if (key >= (int)stamp.size()) {
+                        stamp.resize(key + 1);
+                    }
+                    if (stamp[key] != generation) {
+                        stamp[key] = generation;
+                        list->push_back(packet);
+                    }
+                }
+            }
+            const std::vector <int> *expected = nullptr;
+            if (spine_packets[spine].compare_exchange_strong(expected, list, std::memory_order_acq_rel)) {
+                packets = list;
+            }
+            else {
+                delete list;
+                packets = expected;
+            }
+        }
+        return {packets->data(), packets->data() + packets->size()};
+    }
+
+    int NullChunk() {
+        static int id = [] {
+            Chunk chunk;
+            chunk.fill(null_slot);
+            return InternChunk(chunk);
+        }();
+        return id;
+    }
+
+    // The hash of a heap is a sum of one term per chunk and one term for the
+    // size, so replacing a chunk updates it in constant time instead of
+    // rehashing the whole heap.
+    uint64_t ChunkTerm(int position, int chunk) {
+        return Avalanche(chunks.Hash(chunk) + (uint64_t)(position + 1) * 0x9E3779B97F4A7C15ull);
+    }
+
+    uint64_t SizeTerm(int size) {
+        return Avalanche(~(uint64_t)size);
+    }
+
+    // Copy of an interned spine being edited, with its hash kept up to date.
+    struct Edit {
+        Spine spine;
+        uint64_t hash;
+
+        Edit(int id) : spine(spines.Get(id)), hash(spines.Hash(id)) {
+        }
+
+        void Replace(int position, int chunk) {
+            hash += ChunkTerm(position, chunk) - ChunkTerm(position, spine.chunks[position]);
+            spine.chunks[position] = chunk;
+        }
+
+        void Resize(int size) {
+            int count = (size + chunk_size - 1) >> chunk_bits;
+            while ((int)spine.chunks.size() > count) {
+                hash -= ChunkTerm((int)spine.chunks.size() - 1, spine.chunks.back());
+                spine.chunks.pop_back();
+            }
+            while ((int)spine.chunks.size() < count) {
+                hash += ChunkTerm((int)spine.chunks.size(), NullChunk());
+                spine.chunks.push_back(NullChunk());
+            }
+            hash += SizeTerm(size) - SizeTerm(spine.size);
+            spine.size = size;
+        }
+
+        int Intern() const {
+            return spines.Intern(spine, hash);
+        }
+    };
+
+    State::State() {
+        static int empty = spines.Intern(Spine{{}, 0}, SizeTerm(0));
+        id = empty;
+    }
+
+    int State::Size() const {
+        return spines.Get(id).size;
+    }
+
+    Slot State::operator [](int index) const {
+        const Spine &spine = spines.Get(id);
+        return ChunkSlots(spine.chunks[index >> chunk_bits])[index & (chunk_size - 1)];
+    }
+
+    uint64_t State::Hash() const {
+        return spines.Hash(id);
+    }
+
+    State State::Set(int index, Slot slot) const {
+        if (index < 0 || index >= Size()) {
+            return *this;
+        }
+        Edit edit(id);
+        Chunk chunk = ChunkSlots(edit.spine.chunks[index >> chunk_bits]);
+        if (chunk[index & (chunk_size - 1)] == slot) {
+            return *this;
+        }
+        chunk[index & (chunk_size - 1)] = slot;
+        edit.Replace(index >> chunk_bits, InternChunk(chunk));
+        return State(edit.Intern());
+    }
+
+    State State::Push(Slot slot) const {
+        Edit edit(id);
+        int index = edit.spine.size;
+        edit.Resize(index + 1);
+        if (slot != null_slot) {
+            Chunk chunk = ChunkSlots(edit.spine.chunks.back());
+            chunk[index & (chunk_size - 1)] = slot;
+            edit.Replace(index >> chunk_bits, InternChunk(chunk));
+        }
+        return State(edit.Intern());
+    }
+
+    State State::Pop(int count) const {
+        if (count <= 0) {
+            return *this;
+        }
+        Edit edit(id);
+        int size = edit.spine.size - count;
+        edit.Resize(size);
+        int used = size & (chunk_size - 1);
+        if (used) {
+            // Slots past the end are kept null so that equal heaps stay equal
+            // chunk by chunk.
+            Chunk chunk = ChunkSlots(edit.spine.chunks.back());
+            std::fill(chunk.begin() + used, chunk.end(), null_slot);
+            edit.Replace(size >> chunk_bits, InternChunk(chunk));
+        }
+        return State(edit.Intern());
+    }
+
+    State State::ClearPacket(int packet, int except) const {
+        Edit edit(id);
+        bool changed = false;
+        for (int c = 0; c < (int)edit.spine.chunks.size(); c++) {
+            Chunk chunk = ChunkSlots(edit.spine.chunks[c]);
+            bool found = false;
+            for (int j = 0; j < chunk_size; j++) {
+                int index = (c << chunk_bits) + j;
+                if (index < edit.spine.size && index != except && PacketOf(chunk[j].first) == packet) {
+                    chunk[j] = null_slot;
+                    found = true;
+                }
+            }
+            if (found) {
+                edit.Replace(c, InternChunk(chunk));
+                changed = true;
+            }
+        }
+        if (!changed) {
+            return *this;
+        }
+        return State(edit.Intern());
+    }
+
+    void State::MarkPackets(std::vector <bool> &used) const {
+        for (int packet : SpinePackets(id)) {
+            if (packet >= 0) {
+                used[packet] = true;
+            }
+        }
+    }
+
+    void Canonicalizer::SetGroups(const std::vector <int> &_group, const std::vector <std::vector <int>> &_members) {
+        if (_group == group && _members == members) {
+            return;
+        }
+        group = _group;
+        members = _members;
+        memo.clear();
+        chunk_hashes.clear();
+        renumbered_roots.clear();
+    }
+
+    bool Canonicalizer::MayMerge(const StateSet &states) {
+        if (!states.expanded) {
+            return MayMergeDiagram(states);
+        }
+        std::unordered_set <uint64_t> hashes;
+        for (State state : states) {
+            const Spine &spine = spines.Get(state.id);
+            uint64_t hash = SizeTerm(spine.size);
+            for (int c = 0; c < (int)spine.chunks.size(); c++) {
+                int chunk = spine.chunks[c];
+                if (chunk >= (int)chunk_hashes.size()) {
+                    chunk_hashes.resize(chunk + 1, 0);
+                }
+                if (!chunk_hashes[chunk]) {
+                    Chunk slots = ChunkSlots(chunk);
+                    for (Slot &slot : slots) {
+                        int packet = PacketOf(slot.first);
+                        if (slot.first != -1 && group[packet] != -1) {
+                            // Far below the numbers of maybe-null
+                            // pointers, which are kept apart.
+                            slot.first = INT_MIN + 2 * group[packet] + (slot.first < -1);
+                        }
+                    }
+                    chunk_hashes[chunk] = HashOf(slots) | 1;
+                }
+                hash += Avalanche(chunk_hashes[chunk] + (uint64_t)(c + 1) * 0x9E3779B97F4A7C15ull);
+            }
+            if (!hashes.insert(hash).second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    State Canonicalizer::operator ()(State state) {
+        if (state.id < (int)memo.size() && memo[state.id] != -1) {
+            return State(memo[state.id]);
+        }
+        State canonical = Renumber(state);
+        if ((int)memo.size() <= std::max(state.id, canonical.id)) {
+            memo.resize(std::max(state.id, canonical.id) + 1, -1);
+        }
+        memo[state.id] = canonical.id;
+        memo[canonical.id] = canonical.id;
+        return canonical;
+    }
+
+    State Canonicalizer::Renumber(State state) {
+        if (target.size() < group.size()) {
+            target.resize(group.size());
+            stamp.resize(group.size());
+        }
+        generation++;
+        next.assign(members.size(), 0);
+
+        bool identity = true;
+        for (int first : SpinePackets(state.id)) {
+            int packet = PacketOf(first);
+            if (group[packet] == -1 || stamp[packet] == generation) {
+                continue;
+            }
+            stamp[packet] = generation;
+            int g = group[packet];
+            target[packet] = members[g][next[g]++];
+            identity &= target[packet] == packet;
+        }
+        if (identity) {
+            // The referenced packets already are the first members of their
+            // groups in order, so the rest map to themselves too.
+            return state;
+        }
+        for (int g = 0; g < (int)members.size(); g++) {
+            for (int packet : members[g]) {
+                if (stamp[packet] != generation) {
+                    stamp[packet] = generation;
+                    target[packet] = members[g][next[g]++];
+                }
+            }
+        }
+
+        Edit edit(state.id);
+        for (int c = 0; c < (int)edit.spine.chunks.size(); c++) {
+            bool renamed = false;
+            for (int first : ChunkPackets(edit.spine.chunks[c])) {
+                int packet = PacketOf(first);
+                renamed |= group[packet] != -1 && target[packet] != packet;
+            }
+            if (!renamed) {
+                continue;
+            }
+            Chunk chunk = ChunkSlots(edit.spine.chunks[c]);
+            for (Slot &slot : chunk) {
+                if (slot.first >= 0 && group[slot.first] != -1) {
+                    slot.first = target[slot.first];
+                }
+                else if (slot.first < -1 && group[PacketOf(slot.first)] != -1) {
+                    slot.first = -2 - target[PacketOf(slot.first)];
+                }
+            }
+            edit.Replace(c, InternChunk(chunk));
+        }
+        return State(edit.Intern());
+    }
+
+    State State::Swap(int a, int b) const {
+        if (a == b) {
+            return *this;
+        }
+        Edit edit(id);
+        bool changed = false;
+        for (int c = 0; c < (int)edit.spine.chunks.size(); c++) {
+            bool found = false;
+            for (int first : ChunkPackets(edit.spine.chunks[c])) {
+                found |= PacketOf(first) == a || PacketOf(first) == b;
+            }
+            if (!found) {
+                continue;
+            }
+            Chunk chunk = ChunkSlots(edit.spine.chunks[c]);
+            for (Slot &slot : chunk) {
+                int packet = PacketOf(slot.first);
+                if (packet == a || packet == b) {
+                    int other = packet == a ? b : a;
+                    slot.first = slot.first >= 0 ? other : -2 - other;
+                }
+            }
+            edit.Replace(c, InternChunk(chunk));
+            changed = true;
+        }
+        if (!changed) {
+            return *this;
+        }
+        return State(edit.Intern());
+    }
+
+    State State::Shape() const {
+        Edit edit(id);
+        bool changed = false;
+        for (int c = 0; c < (int)edit.spine.chunks.size(); c++) {
+            int shape = chunks.Get(edit.spine.chunks[c]).shape;
+            if (shape != -1) {
+                edit.Replace(c, shape);
+                changed = true;
+            }
+        }
+        if (!changed) {
+            return *this;
+        }
+        return State(edit.Intern());
+    }
+
+    // Combines two states of equal shape slot by slot. Chunks the states
+    // share are kept as they are.
+    template <class Combine>
+    int CombineSlots(int a, int b, Combine combine) {
+        if (a == b) {
+            return a;
+        }
+        Edit edit(a);
+        const Spine &other = spines.Get(b);
+        bool changed = false;
+        for (int c = 0; c < (int)edit.spine.chunks.size(); c++) {
+            int x = edit.spine.chunks[c], y = other.chunks[c];
+            if (x == y) {
+                continue;
+            }
+            Chunk chunk = ChunkSlots(x);
+            const Chunk &from = ChunkSlots(y);
+            for (int j = 0; j < chunk_size; j++) {
+                chunk[j] = combine(chunk[j], from[j]);
+            }
+            int combined = InternChunk(chunk);
+            if (combined != x) {
+                edit.Replace(c, combined);
+                changed = true;
+            }
+        }
+        if (!changed) {
+            return a;
+        }
+        return edit.Intern();
+    }
+
+    State State::Join(State other) const {
+        return State(CombineSlots(id, other.id, [](Slot a, Slot b) {
+            return Slot(a.first, Linear::Min(a.second, b.second), Linear::Max(a.last, b.last));
+        }));
+    }
+
+    State State::Widen(State other) const {
+        return State(CombineSlots(id, other.id, [](Slot a, Slot b) {
+            return Slot(a.first,
+                b.second != a.second ? -unbounded_offset : a.second,
+                b.last != a.last ? unbounded_offset : a.last);
+        }));
+    }
+
+    // Id of the state with slot index set to slot, or -1 if no such state
+    // was ever interned. Nothing is interned.
+    int FindWith(int id, int index, Slot slot) {
+        Edit edit(id);
+        Chunk chunk = ChunkSlots(edit.spine.chunks[index >> chunk_bits]);
+        chunk[index & (chunk_size - 1)] = slot;
+        ChunkData data;
+        data.slots = chunk;
+        int chunk_id = chunks.Find(data, HashOf(chunk));
+        if (chunk_id == -1) {
+            return -1;
+        }
+        edit.Replace(index >> chunk_bits, chunk_id);
+        return spines.Find(edit.spine, edit.hash);
+    }
+
+    int Subsume(StateSet &states) {
+        int old_size = states.Size();
+        while (true) {
+            // A state with slot i null or a pointer, found as the state
+            // that differs in slot i only, mapped to that state and i.
+            std::unordered_map <int, std::pair <int, int>> nulled, pointer;
+            for (State state : states) {
+                const Spine &spine = spines.Get(state.id);
+                for (int c = 0; c < (int)spine.chunks.size(); c++) {
+                    if (chunks.Get(spine.chunks[c]).count == 0) {
+                        continue;
+                    }
+                    const Chunk &chunk = ChunkSlots(spine.chunks[c]);
+                    for (int j = 0; j < chunk_size; j++) {
+                        Slot slot = chunk[j];
+                        if (slot.first == -1) {
+                            continue;
+                        }
+                        int index = (c << chunk_bits) + j;
+                        int other = FindWith(state.id, index, null_slot);
+                        if (other != -1 && states.Contains(State(other))) {
+                            nulled.emplace(other, std::make_pair(state.id, index));
+                        }
+                        if (slot.first < -1) {
+                            other = FindWith(state.id, index, {PacketOf(slot.first), slot.second, slot.last});
+                            if (other != -1 && states.Contains(State(other))) {
+                                pointer.emplace(other, std::make_pair(state.id, index));
+                            }
+                        }
+                    }
+                }
+            }
+            if (nulled.empty() && pointer.empty()) {
+                break;
+            }
+
+            std::unordered_set <int> removed;
+            std::vector <State> joined;
+            for (State state : states) {
+                if (removed.count(state.id)) {
+                    continue;
+                }
+                auto it = pointer.find(state.id);
+                if (it != pointer.end() && !removed.count(it->second.first)) {
+                    removed.insert(state.id);
+                    continue;
+                }
+                it = nulled.find(state.id);
+                if (it == nulled.end() || removed.count(it->second.first)) {
+                    continue;
+                }
+                State other(it->second.first);
+                Slot slot = other[it->second.second];
+                removed.insert(state.id);
+                if (slot.first >= 0) {
+                    removed.insert(other.id);
+                    joined.push_back(other.Set(it->second.second, MaybeNull(slot)));
+                }
+            }
+            StateSet _states;
+            for (State state : states) {
+                if (!removed.count(state.id)) {
+                    _states.Insert(state);
+                }
+            }
+            for (State state : joined) {
+                _states.Insert(state);
+            }
+            states = _states;
+        }
+        return old_size - states.Size();
+    }
+
+    std::vector <Slot> State::Heap() const {
+        const Spine &spine = spines.Get(id);
+        std::vector <Slot> heap;
+        heap.reserve(spine.size);
+        for (int i = 0; i < spine.size; i++) {
+            heap.push_back(ChunkSlots(spine.chunks[i >> chunk_bits])[i & (chunk_size - 1)]);
+        }
+        return heap;
+    }
+
+    void StateSet::Grow() {
+        Rehash(std::max(index.size() * 2, (size_t)16));
+    }
+
+    void StateSet::Rehash(size_t capacity) const {
+        index.assign(capacity, -1);
+        size_t mask = index.size() - 1;
+        for (int i = 0; i < (int)states.size(); i++) {
+            size_t slot = states[i].Hash() & mask;
+            while (index[slot] != -1) {
+                slot = (slot + 1) & mask;
+            }
+            index[slot] = i;
+        }
+    }
+
+    bool StateSet::Insert(State state) {
+        Expand();
+        if ((states.size() + 1) * 2 > index.size()) {
+            Grow();
+        }
+        size_t mask = index.size() - 1;
+        for (size_t slot = state.Hash() & mask; ; slot = (slot + 1) & mask) {
+            if (index[slot] == -1) {
+                index[slot] = (int)states.size();
+                states.push_back(state);
+                diagram = -1;
+                return true;
+            }
+            if (states[index[slot]] == state) {
+                return false;
+            }
+        }
+    }
+
+    bool StateSet::Union(const StateSet &other) {
+        if (!expanded || !other.expanded) {
+            return UnionDiagrams(other);
+        }
+        bool added = false;
+        for (State state : other.states) {
+            added |= Insert(state);
+        }
+        return added;
+    }
+
+    bool StateSet::Contains(State state) const {
+        Expand();
+        if (index.empty()) {
+            return false;
+        }
+        size_t mask = index.size() - 1;
+        for (size_t slot = state.Hash() & mask; index[slot] != -1; slot = (slot + 1) & mask) {
+            if (states[index[slot]] == state) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void StateSet::Clear() {
+        states.clear();
+        index.clear();
+        expanded = true;
+        diagram = -1;
+        count = -1;
+    }
+
+    std::vector <State> Sorted(const StateSet &states) {
+        std::vector <std::pair <std::vector <Slot>, State>> heaps;
+        for (State state : states) {
+            heaps.push_back({state.Heap(), state});
+        }
+        std::sort(heaps.begin(), heaps.end());
+        std::vector <State> result;
+        for (auto &heap : heaps) {
+            result.push_back(heap.second);
+        }
+        return result;
+    }
+}
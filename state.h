@@ -0,0 +1,265 @@
+#ifndef STATE_H_INCLUDED
+#define STATE_H_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace AST {
+    class StateSet;
+
+    // Offsets are kept within -unbounded_offset..unbounded_offset. A bound
+    // at the limit stands for any offset beyond it, see State::Widen.
+    const int unbounded_offset = 1 << 29;
+
+    // Heap slot of a variable in a validator state: packet id, or -1 for a
+    // null pointer, and the range second..last of offsets in the packet it
+    // may point to.
+    struct Slot {
+        int first;
+        int second;
+        int last;
+
+        Slot(int _first = -1, int _second = 0) : first(_first), second(_second), last(_second) {
+        }
+
+        Slot(int _first, int _second, int _last) : first(_first), second(_second), last(_last) {
+        }
+
+        bool operator ==(const Slot &other) const {
+            return first == other.first && second == other.second && last == other.last;
+        }
+
+        bool operator !=(const Slot &other) const {
+            return !(*this == other);
+        }
+
+        bool operator <(const Slot &other) const {
+            if (first != other.first) {
+                return first < other.first;
+            }
+            if (second != other.second) {
+                return second < other.second;
+            }
+            return last < other.last;
+        }
+    };
+
+    inline int ShiftOffset(int offset, int by) {
+        long long result = (long long)offset + by;
+        return (int)std::max <long long> (-unbounded_offset, std::min <long long> (unbounded_offset, result));
+    }
+
+    // The pointer slot moved by any amount from low to high.
+    inline Slot Shift(Slot slot, int low, int high) {
+        return {slot.first, ShiftOffset(slot.second, low), ShiftOffset(slot.last, high)};
+    }
+
+    // A maybe-null slot stands for both null and the pointer into packet p
+    // at its offsets, with p stored as -2 - p. Only the subsumption mode of
+    // the validator makes them; checks treat them as possibly null.
+    inline Slot MaybeNull(Slot slot) {
+        return {-2 - slot.first, slot.second, slot.last};
+    }
+
+    inline int PacketOf(int first) {
+        return first < -1 ? -2 - first : first;
+    }
+
+    // Immutable validator state. Slots are kept in fixed-size chunks, and
+    // both the chunks and the lists of chunks are hash-consed in a global
+    // table, so a State is just an id: equal heaps have equal ids, copies are
+    // free and changing one slot interns one chunk and one chunk list instead
+    // of copying the whole heap. States can be made and read from several
+    // threads at once; ids then depend on timing, but equal heaps still get
+    // equal ids.
+    class State {
+    public:
+        State();
+
+        int Size() const;
+        Slot operator [](int index) const;
+        // Writing past the end of the heap leaves the state unchanged.
+        State Set(int index, Slot slot) const;
+        State Push(Slot slot) const;
+        State Pop(int count) const;
+        // Sets every slot pointing, or maybe pointing, into packet to null,
+        // except the slot except.
+        State ClearPacket(int packet, int except) const;
+        // Sets used[p] for every packet p some slot points into, maybe-null
+        // slots aside.
+        void MarkPackets(std::vector <bool> &used) const;
+        // Exchanges the numbers of packets a and b.
+        State Swap(int a, int b) const;
+        // The state with every offset range set to 0..0. States of equal
+        // shape differ in their offsets only.
+        State Shape() const;
+        // The state of the same shape whose ranges are the smallest that
+        // cover those of both states.
+        State Join(State other) const;
+        // Each bound other moves outward goes to the unbounded offset, so
+        // that repeated widening stops growing. Other has to cover this
+        // state, like a join with it does.
+        State Widen(State other) const;
+        std::vector <Slot> Heap() const;
+        // Hash of the heap, maintained incrementally by the updates.
+        uint64_t Hash() const;
+
+        bool operator <(const State &other) const {
+            return id < other.id;
+        }
+
+        bool operator ==(const State &other) const {
+            return id == other.id;
+        }
+
+        bool operator !=(const State &other) const {
+            return id != other.id;
+        }
+
+    private:
+        friend class Canonicalizer;
+        friend int Subsume(StateSet &states);
+
+        int id;
+
+        explicit State(int _id) {
+            id = _id;
+        }
+    };
+
+    // Renumbers interchangeable packets so that within each group they are
+    // numbered in order of first reference over the slots. Results are
+    // memoized per state until the groups change.
+    class Canonicalizer {
+    public:
+        // group[p] is the index in members of the group of packet p, or -1
+        // for packets that keep their number; members lists each group in
+        // ascending order.
+        void SetGroups(const std::vector <int> &_group, const std::vector <std::vector <int>> &_members);
+        State operator ()(State state);
+        // Returns whether renumbering may merge some states of the set. It
+        // compares a hash of each state that does not depend on the numbers
+        // of grouped packets, so false means that no two states merge.
+        bool MayMerge(const StateSet &states);
+        // Renumbers every state of a set into result, as a diagram
+        // operation. Returns false if it gives up, see diagram.cpp.
+        bool operator ()(const StateSet &states, StateSet &result);
+
+    private:
+        std::vector <int> group;
+        std::vector <std::vector <int>> members;
+        std::vector <int> memo;
+        // Hash of each chunk with grouped packets replaced by their group,
+        // or 0 where not computed yet, kept until the groups change like
+        // memo.
+        std::vector <uint64_t> chunk_hashes;
+        // Renumbered diagrams by root, or -1 where renumbering gave up,
+        // kept until the groups change like memo.
+        std::unordered_map <int, int> renumbered_roots;
+        std::vector <int> target, stamp, next;
+        int generation = 0;
+
+        State Renumber(State state);
+        // MayMerge for a set kept as a diagram only, see diagram.cpp.
+        bool MayMergeDiagram(const StateSet &states);
+    };
+
+    // Set of states in insertion order. Membership is an open-addressing
+    // table of positions keyed by the cached hash of each state, so inserts
+    // do not compare heaps and a transfer function fills a fresh set in
+    // linear time.
+    //
+    // A set can also be kept as a decision diagram over the slots, see
+    // diagram.cpp, where states sharing a prefix or a suffix of their heaps
+    // share its nodes. Independent choices for several slots then take
+    // space for the choices, not for their product. The diagram operations
+    // below transform all states at once and give a set kept as a diagram
+    // only. Its states are listed, in lexicographic order of their heaps,
+    // when they are first read.
+    class StateSet {
+    public:
+        // Returns whether the state was not in the set yet.
+        bool Insert(State state);
+        // Returns whether any state of other was not in the set yet.
+        bool Union(const StateSet &other);
+        bool Contains(State state) const;
+        void Clear();
+
+        int Size() const {
+            return expanded ? (int)states.size() : Count();
+        }
+
+        // States in insertion order.
+        State operator [](int i) const {
+            Expand();
+            return states[i];
+        }
+
+        std::vector <State>::const_iterator begin() const {
+            Expand();
+            return states.begin();
+        }
+
+        std::vector <State>::const_iterator end() const {
+            Expand();
+            return states.end();
+        }
+
+        // Lists the states of a set kept as a diagram only. Reading the
+        // states does it too, so a set read from several threads has to be
+        // expanded first.
+        void Expand() const;
+
+        // Diagram operations, each the State operation of the same name
+        // applied to every state.
+        StateSet Set(int index, Slot slot) const;
+        StateSet Push(Slot slot) const;
+        StateSet Pop(int count) const;
+        StateSet ClearPacket(int packet, int except) const;
+        StateSet Swap(int a, int b) const;
+        // Sets slot index of every state to f of its slot from.
+        StateSet Copy(int from, int index, const std::function <Slot (Slot)> &f) const;
+        // The states whose slot index satisfies keep.
+        StateSet Where(int index, const std::function <bool (Slot)> &keep) const;
+        // Distinct values of slot index over the states, in ascending order.
+        std::vector <Slot> Values(int index) const;
+        // Whether some state has no slot pointing into packet, maybe-null
+        // slots aside.
+        bool Misses(int packet) const;
+
+    private:
+        friend class Canonicalizer;
+
+        mutable std::vector <State> states;
+        mutable std::vector <int> index;
+        // Whether states lists the set, and the root of its diagram, or -1
+        // if that is not built, with the size of the heaps and the number
+        // of states, or -1 if not counted yet.
+        mutable bool expanded = true;
+        mutable int diagram = -1;
+        mutable int heap_size = 0;
+        mutable int count = -1;
+
+        void Grow();
+        void Rehash(size_t capacity) const;
+        int Count() const;
+        int Diagram() const;
+        bool UnionDiagrams(const StateSet &other);
+        static StateSet FromDiagram(int root, int heap_size);
+    };
+
+    // Joins states that differ in one slot only, null in one and a pointer
+    // in the other, into one state with that slot maybe-null, and drops
+    // states that differ from another one only in a slot that is maybe-null
+    // there. Repeats until nothing changes and returns the number of states
+    // removed.
+    int Subsume(StateSet &states);
+
+    // States in lexicographic order of their heaps.
+    std::vector <State> Sorted(const StateSet &states);
+}
+
+#endif // STATE_H_INCLUDED
@@ -0,0 +1,43 @@
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "symbols.h"
+
+namespace Symbols {
+    std::deque <std::string> names;
+    std::unordered_map <std::string_view, int> index;
+    std::mutex mutex;
+    // Per-thread front of the table so lexing threads only take the lock
+    // for names they have not seen yet. The views point into names.
+    thread_local std::unordered_map <std::string_view, int> local_index;
+
+    int Intern(std::string_view str) {
+        auto it = local_index.find(str);
+        if (it != local_index.end()) {
+            return it->second;
+        }
+        int id;
+        const std::string *name;
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            auto global = index.find(str);
+            if (global != index.end()) {
+                id = global->second;
+            }
+            else {
+                id = (int)names.size();
+                names.emplace_back(str);
+                index[names.back()] = id;
+            }
+            name = &names[id];
+        }
+        local_index[*name] = id;
+        return id;
+    }
+
+    const std::string &Get(int id) {
+        std::lock_guard <std::mutex> lock(mutex);
+        return names[id];
+    }
+}
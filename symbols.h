@@ -0,0 +1,12 @@
+#ifndef SYMBOLS_H_INCLUDED
+#define SYMBOLS_H_INCLUDED
+
+#include <string>
+#include <string_view>
+
+namespace Symbols {
+    int Intern(std::string_view str);
+    const std::string &Get(int id);
+}
+
+#endif // SYMBOLS_H_INCLUDED
@@ -1,321 +1,271 @@
-#include <fstream>
-#include <functional>
 #include "syntax.h"
 #include "exception.h"
-#include "process.h"
+#include "include.h"
+#include "symbols.h"
 
 namespace Syntax {
-    std::shared_ptr <AST::Block> ProcessProgram(TokenStream &ts) {
-        std::shared_ptr <AST::Block> block = std::make_shared <AST::Block> ();
-        block->line_begin = ts.GetToken().line_begin;
-        block->position_begin = ts.GetToken().position_begin;
-        block->filename = ts.GetToken().filename;
-        while(ts.GetToken().type != TokenType::Eof && ts.GetToken().type != TokenType::BraceClose) {
-            if (ts.GetToken().type == TokenType::Include) {
-                std::string filename = ts.GetToken().value_string;
-                std::ifstream fin(filename);
-                if (!fin) {
-                    throw AliasException("Could not open file " + filename, ts.GetToken());
-                }
-                std::shared_ptr <AST::Node> node = Parse(filename);
-                std::shared_ptr <AST::Block> inc_block = std::dynamic_pointer_cast <AST::Block> (node);
-                for (auto inc_statement : inc_block->statement_list) {
-                    block->statement_list.push_back(inc_statement);
-                }
-                ts.NextToken();
+    // File being parsed on this thread, taken once in Process so that nodes
+    // are located without the lock of the file list.
+    thread_local const Source::File *file = nullptr;
+
+    void SetBegin(AST::Node *node, const Token &token) {
+        Source::Locate(file->lines, token.begin, node->line_begin, node->position_begin);
+        node->file = token.file;
+    }
+
+    void SetEnd(AST::Node *node, const Token &token) {
+        Source::Locate(file->lines, token.end, node->line_end, node->position_end);
+    }
+
+    thread_local std::vector <Splice> *deferred = nullptr;
+
+    void DeferIncludes(std::vector <Splice> *splices) {
+        deferred = splices;
+    }
+
+    void Link(const std::vector <Splice> &splices) {
+        std::vector <AST::Block*> inc_blocks;
+        for (const Splice &splice : splices) {
+            inc_blocks.push_back(Include::Get(Symbols::Get(splice.token.value), splice.token));
+        }
+        for (int i = (int)splices.size() - 1; i >= 0; i--) {
+            if (inc_blocks[i]) {
+                std::vector <AST::Statement*> &list = splices[i].block->statement_list;
+                list.insert(list.begin() + splices[i].index,
+                            inc_blocks[i]->statement_list.begin(), inc_blocks[i]->statement_list.end());
+            }
+        }
+    }
+
+    void ProcessInclude(TokenStream &ts, AST::Block *block) {
+        const Token &token = ts.Next();
+        if (deferred) {
+            deferred->push_back({block, block->statement_list.size(), token});
+            return;
+        }
+        AST::Block *inc_block = Include::Get(Symbols::Get(token.value), token);
+        if (inc_block) {
+            block->statement_list.insert(block->statement_list.end(),
+                                         inc_block->statement_list.begin(), inc_block->statement_list.end());
+        }
+    }
+
+    AST::Block *ProcessProgram(TokenStream &ts) {
+        AST::Block *block = AST::New <AST::Block> ();
+        SetBegin(block, ts.Peek());
+        while(!ts.Check(TokenType::Eof) && !ts.Check(TokenType::BraceClose)) {
+            if (ts.Check(TokenType::Include)) {
+                ProcessInclude(ts, block);
                 continue;
             }
-            std::shared_ptr <AST::Statement> _statement = ProcessStatement(ts);
+            AST::Statement *_statement = ProcessStatement(ts);
             if (_statement) {
                 block->statement_list.push_back(_statement);
             }
         }
-        block->line_end = ts.GetToken().line_end;
-        block->position_end = ts.GetToken().position_end;
+        SetEnd(block, ts.Peek());
         return block;
     }
 
-    std::shared_ptr <AST::Block> ProcessBlock(TokenStream &ts) {
-        std::shared_ptr <AST::Block> block = std::make_shared <AST::Block> ();
-        block->line_begin = ts.GetToken().line_begin;
-        block->position_begin = ts.GetToken().position_begin;
-        block->filename = ts.GetToken().filename;
-        ts.NextToken();
-        while(ts.GetToken().type != TokenType::Eof && ts.GetToken().type != TokenType::BraceClose) {
-            if (ts.GetToken().type == TokenType::Include) {
-                std::string filename = ts.GetToken().value_string;
-                std::ifstream fin(filename);
-                if (!fin) {
-                    throw AliasException("Could not open file " + filename, ts.GetToken());
-                }
-                std::shared_ptr <AST::Node> node = Parse(filename);
-                std::shared_ptr <AST::Block> inc_block = std::dynamic_pointer_cast <AST::Block> (node);
-                for (auto inc_statement : inc_block->statement_list) {
-                    block->statement_list.push_back(inc_statement);
-                }
-                ts.NextToken();
+    AST::Block *ProcessBlock(TokenStream &ts) {
+        AST::Block *block = AST::New <AST::Block> ();
+        SetBegin(block, ts.Peek());
+        ts.Next();
+        while(!ts.Check(TokenType::Eof) && !ts.Check(TokenType::BraceClose)) {
+            if (ts.Check(TokenType::Include)) {
+                ProcessInclude(ts, block);
                 continue;
             }
-            std::shared_ptr <AST::Statement> _statement = ProcessStatement(ts);
+            AST::Statement *_statement = ProcessStatement(ts);
             if (_statement) {
                 block->statement_list.push_back(_statement);
             }
         }
-        if (ts.GetToken().type != TokenType::BraceClose) {
-            throw AliasException("} expected after block", ts.GetToken());
+        if (!ts.Check(TokenType::BraceClose)) {
+            throw AliasException("} expected after block", ts.Peek());
         }
-        block->line_end = ts.GetToken().line_end;
-        block->position_end = ts.GetToken().position_end;
+        SetEnd(block, ts.Peek());
         return block;
     }
 
-    std::shared_ptr <AST::Expression> ProcessExpression(TokenStream &ts) {
-        enum class Operation {
-            Unary,
-            Binary,
-            Parenthesis
-        };
-        std::vector <std::shared_ptr <AST::Expression>> primaries;
-        std::vector <std::pair <Token, Operation>> operations;
+    template <class T>
+    AST::BinaryOperation *MakeBinary() {
+        return AST::New <T> ();
+    }
 
-        std::function <bool()> next_is_operation = [&]() {
-            if (ts.GetToken().type == TokenType::Plus ||
-                ts.GetToken().type == TokenType::Minus ||
-                ts.GetToken().type == TokenType::Mult ||
-                ts.GetToken().type == TokenType::Div ||
-                ts.GetToken().type == TokenType::Less ||
-                ts.GetToken().type == TokenType::Equal)
-                return true;
-            else
-                return false;
-        };
+    // Binding power of every token in infix position; higher binds tighter
+    // and all operators are left associative. A token with power 0 ends the
+    // expression. Prefix forms ($, alloc, parentheses) are handled by
+    // ProcessExpression and bind tighter than any infix operator. A new binary
+    // operator only needs an entry here and an AST node.
+    struct Infix {
+        int power;
+        AST::BinaryOperation *(*make)();
+    };
 
-        std::function <int(std::pair <Token, Operation>)> operation_priority = [&](std::pair <Token, Operation> operation) {
-            Token token = operation.first;
-            if (token.type == TokenType::Mult ||
-                token.type == TokenType::Div)
-                return 1;
-            if (token.type == TokenType::Plus ||
-                token.type == TokenType::Minus)
-                return 2;
-            if (token.type == TokenType::Less ||
-                token.type == TokenType::Equal)
-                return 3;
-            return 4;
-        };
+    struct InfixTable {
+        Infix infix[(int)TokenType::Eof + 1];
+    };
 
-        std::function <void()> process_operation = [&]() {
-            if (operations.back().second == Operation::Binary) {
-                std::shared_ptr <AST::BinaryOperation> root;
-                if (operations.back().first.type == TokenType::Plus)
-                    root = std::make_shared <AST::Addition> ();
-                if (operations.back().first.type == TokenType::Minus)
-                    root = std::make_shared <AST::Subtraction> ();
-                if (operations.back().first.type == TokenType::Mult)
-                    root = std::make_shared <AST::Multiplication> ();
-                if (operations.back().first.type == TokenType::Div)
-                    root = std::make_shared <AST::Division> ();
-                if (operations.back().first.type == TokenType::Less)
-                    root = std::make_shared <AST::Less> ();
-                if (operations.back().first.type == TokenType::Equal)
-                    root = std::make_shared <AST::Equal> ();
-                if (!root) {
-                    throw AliasException("Binary operator expected in expression", operations.back().first);
-                }
-                root->left = primaries[primaries.size() - 2];
-                root->right = primaries[primaries.size() - 1];
-                root->line_begin = root->left->line_begin;
-                root->position_begin = root->left->position_begin;
-                root->filename = root->left->filename;
-                root->line_end= root->right->line_end;
-                root->position_end= root->right->position_end;
+    constexpr InfixTable MakeInfixTable() {
+        InfixTable table = {};
+        table.infix[(int)TokenType::Less] = {1, MakeBinary <AST::Less>};
+        table.infix[(int)TokenType::Equal] = {1, MakeBinary <AST::Equal>};
+        table.infix[(int)TokenType::Plus] = {2, MakeBinary <AST::Addition>};
+        table.infix[(int)TokenType::Minus] = {2, MakeBinary <AST::Subtraction>};
+        table.infix[(int)TokenType::Mult] = {3, MakeBinary <AST::Multiplication>};
+        table.infix[(int)TokenType::Div] = {3, MakeBinary <AST::Division>};
+        return table;
+    }
 
-                primaries.pop_back();
-                primaries.pop_back();
-                primaries.push_back(root);
-                operations.pop_back();
-            }
-        };
+    constexpr InfixTable infix_table = MakeInfixTable();
 
-        int ParenthesisLevel = 0;
-        enum class State {
-            Identifier,
-            UnaryOperation,
-            BinaryOperation,
-            ParenthesisOpen,
-            ParenthesisClose
-        };
-        State CurrentState;
-        if (ts.GetToken().type == TokenType::ParenthesisOpen) {
-            operations.push_back({ts.GetToken(), Operation::Parenthesis});
-            ts.NextToken();
-            ParenthesisLevel++;
-            CurrentState = State::ParenthesisOpen;
-        }
-        else if (next_is_operation()) {
-            operations.push_back({ts.GetToken(), Operation::Unary});
-            ts.NextToken();
-            CurrentState = State::UnaryOperation;
-        }
-        else {
-            primaries.push_back(ProcessPrimary(ts));
-            CurrentState = State::Identifier;
-        }
+    // Operators waiting for their right operand, and open parentheses, on
+    // the stack of ProcessExpression.
+    struct Pending {
+        int power;
+        AST::BinaryOperation *operation;
+    };
+
+    void Reduce(std::vector <Pending> &pending, std::vector <AST::Expression*> &operands) {
+        AST::BinaryOperation *root = pending.back().operation;
+        pending.pop_back();
+        root->right = operands.back();
+        operands.pop_back();
+        root->left = operands.back();
+        root->line_begin = root->left->line_begin;
+        root->position_begin = root->left->position_begin;
+        root->file = root->left->file;
+        root->line_end = root->right->line_end;
+        root->position_end = root->right->position_end;
+        operands.back() = root;
+    }
 
-        while (CurrentState == State::UnaryOperation ||
-               CurrentState == State::BinaryOperation ||
-               CurrentState == State::ParenthesisOpen ||
-               next_is_operation() ||
-               ParenthesisLevel) {
-            if (ts.GetToken().type == TokenType::ParenthesisOpen) {
-                if (CurrentState != State::UnaryOperation &&
-                    CurrentState != State::BinaryOperation &&
-                    CurrentState != State::ParenthesisOpen) {
-                    throw AliasException("Unexpected ( in expression", ts.GetToken());
+    // Precedence climbing with explicit stacks, so that the nesting depth of
+    // an expression is not limited by the call stack. An operator reduces
+    // the pending ones that bind at least as tightly, which keeps all of
+    // them left associative; an open parenthesis has power 0.
+    AST::Expression *ProcessExpression(TokenStream &ts) {
+        std::vector <Pending> pending;
+        std::vector <AST::Expression*> operands;
+        // There are no unary operators. The first one is remembered and
+        // reported once the expression is complete, so that other errors in
+        // it are found at the same place as before.
+        const Token *unary = nullptr;
+        bool first = true;
+        while (true) {
+            while (true) {
+                if (ts.Check(TokenType::ParenthesisOpen)) {
+                    pending.push_back({0, nullptr});
+                }
+                else if (infix_table.infix[(int)ts.Peek().type].power) {
+                    if (!unary) {
+                        unary = &ts.Peek();
+                    }
                 }
-                operations.push_back({ts.GetToken(), Operation::Parenthesis});
-                ts.NextToken();
-                ParenthesisLevel++;
-                CurrentState = State::ParenthesisOpen;
-            }
-            else if (ts.GetToken().type == TokenType::ParenthesisClose) {
-                if (CurrentState != State::Identifier &&
-                    CurrentState != State::ParenthesisClose) {
-                    throw AliasException("Unexpected ) in expression", ts.GetToken());
+                else {
+                    break;
                 }
-                while (!operations.empty() && operations.back().first.type != TokenType::ParenthesisOpen) {
-                    process_operation();
+                ts.Next();
+                first = false;
+            }
+            if (!first && ts.Check(TokenType::ParenthesisClose)) {
+                throw AliasException("Unexpected ) in expression", ts.Peek());
+            }
+            operands.push_back(ProcessPrimary(ts));
+            first = false;
+
+            while (true) {
+                const Infix &infix = infix_table.infix[(int)ts.Peek().type];
+                while (!pending.empty() && pending.back().operation && pending.back().power >= (infix.power ? infix.power : 1)) {
+                    Reduce(pending, operands);
                 }
-                if (operations.empty() || operations.back().first.type != TokenType::ParenthesisOpen) {
-                    throw AliasException(") exprected in expression", ts.GetToken());
+                if (infix.power) {
+                    ts.Next();
+                    pending.push_back({infix.power, infix.make()});
+                    break;
                 }
-                operations.pop_back();
-                ts.NextToken();
-                ParenthesisLevel--;
-                CurrentState = State::ParenthesisClose;
-            }
-            else if (next_is_operation()) {
-                if (CurrentState == State::UnaryOperation ||
-                    CurrentState == State::BinaryOperation ||
-                    CurrentState == State::ParenthesisOpen) {
-                    while(!operations.empty() &&
-                          operation_priority(operations.back()) <= operation_priority({ts.GetToken(), Operation::Unary})) {
-                        process_operation();
+                if (pending.empty()) {
+                    if (unary) {
+                        throw AliasException("Unexpected unary operator in expression", *unary);
                     }
-                    operations.push_back({ts.GetToken(), Operation::Unary});
-                    ts.NextToken();
-                    CurrentState = State::UnaryOperation;
+                    return operands.back();
                 }
-                else if (CurrentState == State::Identifier ||
-                         CurrentState == State::ParenthesisClose) {
-                    while(!operations.empty() &&
-                            operation_priority(operations.back()) <= operation_priority({ts.GetToken(), Operation::Binary})) {
-                        process_operation();
-                    }
-                    CurrentState = State::BinaryOperation;
-                    operations.push_back({ts.GetToken(), Operation::Binary});
-                    ts.NextToken();
+                if (ts.Check(TokenType::ParenthesisOpen)) {
+                    throw AliasException("Unexpected ( in expression", ts.Peek());
                 }
-            }
-            else {
-                if (CurrentState != State::UnaryOperation &&
-                    CurrentState != State::BinaryOperation &&
-                    CurrentState != State::ParenthesisOpen) {
-                    throw AliasException("Unexpected identifier in expression", ts.GetToken());
+                if (!ts.Check(TokenType::ParenthesisClose)) {
+                    throw AliasException("Unexpected identifier in expression", ts.Peek());
                 }
-                primaries.push_back(ProcessPrimary(ts));
-                CurrentState = State::Identifier;
+                ts.Next();
+                pending.pop_back();
             }
         }
-
-        while(!operations.empty()) {
-            process_operation();
-        }
-
-        if (primaries.size() != 1) {
-            throw AliasException("Incorrect expression", ts.GetToken());
-        }
-
-        return primaries[0];
     }
 
-    std::shared_ptr <AST::Expression> ProcessPrimary(TokenStream &ts) {
-        if (ts.GetToken().type == TokenType::Dereference) {
-            std::shared_ptr <AST::Dereference> _dereference = std::make_shared <AST::Dereference> ();
-            _dereference->line_begin = ts.GetToken().line_begin;
-            _dereference->position_begin = ts.GetToken().position_begin;
-            _dereference->filename = ts.GetToken().filename;
-            ts.NextToken();
-            std::shared_ptr <AST::Expression> _expression = ProcessPrimary(ts);
+    AST::Expression *ProcessPrimary(TokenStream &ts) {
+        if (ts.Check(TokenType::Dereference)) {
+            AST::Dereference *_dereference = AST::New <AST::Dereference> ();
+            SetBegin(_dereference, ts.Peek());
+            ts.Next();
+            AST::Expression *_expression = ProcessPrimary(ts);
             _dereference->line_end = _expression->line_end;
             _dereference->position_end = _expression->position_end;
             _dereference->arg = _expression;
             return _dereference;
         }
-        if (ts.GetToken().type == TokenType::Identifier) {
-            std::shared_ptr <AST::Identifier> _identifier = std::make_shared <AST::Identifier> ();
-            _identifier->identifier = ts.GetToken().value_string;
-            _identifier->line_begin = ts.GetToken().line_begin;
-            _identifier->position_begin = ts.GetToken().position_begin;
-            _identifier->filename = ts.GetToken().filename;
-            _identifier->line_end = ts.GetToken().line_end;
-            _identifier->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+        if (ts.Check(TokenType::Identifier)) {
+            AST::Identifier *_identifier = AST::New <AST::Identifier> ();
+            _identifier->identifier = ts.Peek().value;
+            SetBegin(_identifier, ts.Peek());
+            SetEnd(_identifier, ts.Peek());
+            ts.Next();
             return _identifier;
         }
-        if (ts.GetToken().type == TokenType::Integer) {
-            std::shared_ptr <AST::Integer> _integer = std::make_shared <AST::Integer> ();
-            _integer->value = ts.GetToken().value_int;
-            _integer->line_begin = ts.GetToken().line_begin;
-            _integer->position_begin = ts.GetToken().position_begin;
-            _integer->filename = ts.GetToken().filename;
-            _integer->line_end = ts.GetToken().line_end;
-            _integer->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+        if (ts.Check(TokenType::Integer)) {
+            AST::Integer *_integer = AST::New <AST::Integer> ();
+            _integer->value = ts.Peek().value;
+            SetBegin(_integer, ts.Peek());
+            SetEnd(_integer, ts.Peek());
+            ts.Next();
             return _integer;
         }
-        if (ts.GetToken().type == TokenType::Alloc) {
-            std::shared_ptr <AST::Alloc> _alloc = std::make_shared <AST::Alloc> ();
-            _alloc->line_begin = ts.GetToken().line_begin;
-            _alloc->position_begin = ts.GetToken().position_begin;
-            _alloc->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in alloc expression", ts.GetToken());
-            }
-            ts.NextToken();
+        if (ts.Check(TokenType::Alloc)) {
+            AST::Alloc *_alloc = AST::New <AST::Alloc> ();
+            SetBegin(_alloc, ts.Peek());
+            ts.Next();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in alloc expression");
             _alloc->expression = ProcessExpression(ts);
-            if (ts.GetToken().type != TokenType::ParenthesisClose) {
-                throw AliasException(") expected in alloc expression", ts.GetToken());
+            if (!ts.Check(TokenType::ParenthesisClose)) {
+                throw AliasException(") expected in alloc expression", ts.Peek());
             }
-            _alloc->line_end = ts.GetToken().line_end;
-            _alloc->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(_alloc, ts.Peek());
+            ts.Next();
             return _alloc;
         }
-        throw AliasException("Identifier expected in primary expression", ts.GetToken());
+        throw AliasException("Identifier expected in primary expression", ts.Peek());
     }
 
-    std::shared_ptr <AST::FunctionSignature> ProcessFunctionSignature(TokenStream &ts) {
-        std::shared_ptr <AST::FunctionSignature> function_signature = std::make_shared <AST::FunctionSignature> ();
+    AST::FunctionSignature *ProcessFunctionSignature(TokenStream &ts) {
+        AST::FunctionSignature *function_signature = AST::New <AST::FunctionSignature> ();
         while (true) {
-            if (ts.GetToken().type == TokenType::ParenthesisClose) {
+            if (ts.Check(TokenType::ParenthesisClose)) {
                 break;
             }
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier expected in argument list", ts.GetToken());
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier expected in argument list", ts.Peek());
             }
-            function_signature->identifiers.push_back(ts.GetToken().value_string);
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Int && ts.GetToken().type != TokenType::Ptr) {
-                throw AliasException("Type expected in argument list", ts.GetToken());
+            function_signature->identifiers.push_back(ts.Peek().value);
+            ts.Next();
+            if (!ts.Check(TokenType::Int) && !ts.Check(TokenType::Ptr)) {
+                throw AliasException("Type expected in argument list", ts.Peek());
             }
-            if (ts.GetToken().type == TokenType::Int) {
+            if (ts.Check(TokenType::Int)) {
                 function_signature->types.push_back(AST::Type::Int);
-                ts.NextToken();
-                if (ts.GetToken().type == TokenType::Const) {
+                ts.Next();
+                if (ts.Check(TokenType::Const)) {
                     function_signature->is_const.push_back(true);
-                    ts.NextToken();
+                    ts.Next();
                 }
                 else {
                     function_signature->is_const.push_back(false);
@@ -325,391 +275,337 @@ namespace Syntax {
             }
             else {
                 function_signature->types.push_back(AST::Type::Ptr);
-                ts.NextToken();
-                if (ts.GetToken().type == TokenType::Const) {
+                ts.Next();
+                if (ts.Check(TokenType::Const)) {
                     function_signature->is_const.push_back(true);
-                    ts.NextToken();
+                    ts.Next();
                 }
                 else {
                     function_signature->is_const.push_back(false);
                 }
                 auto _expression1 = ProcessExpression(ts);
-                if (ts.GetToken().type != TokenType::Colon) {
-                    throw AliasException(": expected in argument list", ts.GetToken());
-                }
-                ts.NextToken();
+                ts.Expect(TokenType::Colon, ": expected in argument list");
                 auto _expression2 = ProcessExpression(ts);
                 function_signature->size_in.push_back(_expression1);
                 function_signature->size_out.push_back(_expression2);
             }
-            if (ts.GetToken().type == TokenType::ParenthesisClose) {
+            if (ts.Check(TokenType::ParenthesisClose)) {
                 break;
             }
-            if (ts.GetToken().type != TokenType::Comma) {
-                throw AliasException(", expected in argument list", ts.GetToken());
-            }
-            ts.NextToken();
+            ts.Expect(TokenType::Comma, ", expected in argument list");
         }
         return function_signature;
     }
 
-    std::vector <std::string> ProcessMetavariables(TokenStream &ts) {
-        std::vector <std::string> metavariables;
+    std::vector <int> ProcessMetavariables(TokenStream &ts) {
+        std::vector <int> metavariables;
         while (true) {
-            if (ts.GetToken().type == TokenType::BracketClose) {
+            if (ts.Check(TokenType::BracketClose)) {
                 break;
             }
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier expected in metavariable list", ts.GetToken());
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier expected in metavariable list", ts.Peek());
             }
-            metavariables.push_back(ts.GetToken().value_string);
-            ts.NextToken();
-            if (ts.GetToken().type == TokenType::BracketClose) {
+            metavariables.push_back(ts.Peek().value);
+            ts.Next();
+            if (ts.Check(TokenType::BracketClose)) {
                 break;
             }
-            if (ts.GetToken().type != TokenType::Comma) {
-                throw AliasException(", expected in metavariables list", ts.GetToken());
-            }
-            ts.NextToken();
+            ts.Expect(TokenType::Comma, ", expected in metavariables list");
         }
         return metavariables;
     }
 
-    std::shared_ptr <AST::Statement> ProcessStatement(TokenStream &ts) {
-        if (ts.GetToken().type == TokenType::Semicolon) {
-            ts.NextToken();
+    AST::Statement *ProcessStatement(TokenStream &ts) {
+        if (ts.Check(TokenType::Semicolon)) {
+            ts.Next();
             return nullptr;
         }
-        if (ts.GetToken().type == TokenType::BraceOpen) {
-            std::shared_ptr <AST::Block> block = ProcessBlock(ts);
-            ts.NextToken();
+        if (ts.Check(TokenType::BraceOpen)) {
+            AST::Block *block = ProcessBlock(ts);
+            ts.Next();
             return block;
         }
-        if (ts.GetToken().type == TokenType::Asm) {
-            std::shared_ptr <AST::Asm> _asm = std::make_shared <AST::Asm> ();
-            _asm->line_begin = ts.GetToken().line_begin;
-            _asm->position_begin = ts.GetToken().position_begin;
-            _asm->filename = ts.GetToken().filename;
-            _asm->line_end = ts.GetToken().line_end;
-            _asm->position_end = ts.GetToken().position_end;
-            _asm->code = ts.GetToken().value_string;
-            ts.NextToken();
+        if (ts.Check(TokenType::Asm)) {
+            AST::Asm *_asm = AST::New <AST::Asm> ();
+            SetBegin(_asm, ts.Peek());
+            SetEnd(_asm, ts.Peek());
+            _asm->code = Symbols::Get(ts.Peek().value);
+            ts.Next();
             return _asm;
         }
-        if (ts.GetToken().type == TokenType::If) {
-            std::shared_ptr <AST::If> _if = std::make_shared <AST::If> ();
-            _if->line_begin = ts.GetToken().line_begin;
-            _if->position_begin = ts.GetToken().position_begin;
-            _if->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in if condition", ts.GetToken());
-            }
-            ts.NextToken();
-            std::shared_ptr <AST::Expression> _expression = ProcessExpression(ts);
-            if (ts.GetToken().type != TokenType::ParenthesisClose) {
-                throw AliasException(") expected in if condition", ts.GetToken());
-            }
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::BraceOpen) {
-                throw AliasException("{ expected in if block", ts.GetToken());
-            }
-            std::shared_ptr <AST::Block> _block = ProcessBlock(ts);
+        if (ts.Check(TokenType::If)) {
+            AST::If *_if = AST::New <AST::If> ();
+            SetBegin(_if, ts.Peek());
+            ts.Next();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in if condition");
+            AST::Expression *_expression = ProcessExpression(ts);
+            ts.Expect(TokenType::ParenthesisClose, ") expected in if condition");
+            if (!ts.Check(TokenType::BraceOpen)) {
+                throw AliasException("{ expected in if block", ts.Peek());
+            }
+            AST::Block *_block = ProcessBlock(ts);
             _if->branch_list.push_back({_expression, _block});
-            _if->line_end = ts.GetToken().line_end;
-            _if->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(_if, ts.Peek());
+            ts.Next();
 
-            if (ts.GetToken().type == TokenType::Else) {
-                ts.NextToken();
-                if (ts.GetToken().type != TokenType::BraceOpen) {
-                    throw AliasException("{ expected in if block", ts.GetToken());
+            if (ts.Check(TokenType::Else)) {
+                ts.Next();
+                if (!ts.Check(TokenType::BraceOpen)) {
+                    throw AliasException("{ expected in if block", ts.Peek());
                 }
-                std::shared_ptr <AST::Block> _block = ProcessBlock(ts);
+                AST::Block *_block = ProcessBlock(ts);
                 _if->else_body = _block;
-                _if->line_end = ts.GetToken().line_end;
-                _if->position_end = ts.GetToken().position_end;
-                ts.NextToken();
+                SetEnd(_if, ts.Peek());
+                ts.Next();
             }
 
             return _if;
         }
-        if (ts.GetToken().type == TokenType::While) {
-            std::shared_ptr <AST::While> _while = std::make_shared <AST::While> ();
-            _while->line_begin = ts.GetToken().line_begin;
-            _while->position_begin = ts.GetToken().position_begin;
-            _while->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in while condition", ts.GetToken());
-            }
-            ts.NextToken();
-            std::shared_ptr <AST::Expression> _expression = ProcessExpression(ts);
-            if (ts.GetToken().type != TokenType::ParenthesisClose) {
-                throw AliasException(") expected in while condition", ts.GetToken());
-            }
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::BraceOpen) {
-                throw AliasException("{ expected in while block", ts.GetToken());
-            }
-            std::shared_ptr <AST::Block> _block = ProcessBlock(ts);
+        if (ts.Check(TokenType::While)) {
+            AST::While *_while = AST::New <AST::While> ();
+            SetBegin(_while, ts.Peek());
+            ts.Next();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in while condition");
+            AST::Expression *_expression = ProcessExpression(ts);
+            ts.Expect(TokenType::ParenthesisClose, ") expected in while condition");
+            // invariant is not reserved, it only has a meaning right after
+            // the condition, where no other identifier can be.
+            static const int invariant = Symbols::Intern("invariant");
+            if (ts.Check(TokenType::Identifier) && ts.Peek().value == invariant) {
+                ts.Next();
+                _while->has_invariant = true;
+                ts.Expect(TokenType::ParenthesisOpen, "( expected in loop invariant");
+                while (!ts.Check(TokenType::ParenthesisClose)) {
+                    if (!_while->invariant.empty()) {
+                        ts.Expect(TokenType::Comma, ", expected in loop invariant");
+                    }
+                    AST::InvariantClause clause;
+                    if (!ts.Check(TokenType::Identifier)) {
+                        throw AliasException("Identifier expected in loop invariant", ts.Peek());
+                    }
+                    clause.identifier = ts.Peek().value;
+                    ts.Next();
+                    if (ts.Check(TokenType::Identifier)) {
+                        clause.base = ts.Peek().value;
+                        ts.Next();
+                        clause.low = ProcessExpression(ts);
+                        ts.Expect(TokenType::Colon, ": expected in loop invariant");
+                        clause.high = ProcessExpression(ts);
+                    }
+                    else if (!ts.Check(TokenType::Integer) || ts.Peek().value != 0) {
+                        throw AliasException("Pointer variable or 0 expected in loop invariant", ts.Peek());
+                    }
+                    else {
+                        ts.Next();
+                    }
+                    _while->invariant.push_back(clause);
+                }
+                ts.Next();
+            }
+            if (!ts.Check(TokenType::BraceOpen)) {
+                throw AliasException("{ expected in while block", ts.Peek());
+            }
+            AST::Block *_block = ProcessBlock(ts);
             _while->expression = _expression;
             _while->block = _block;
-            _while->line_end = ts.GetToken().line_end;
-            _while->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(_while, ts.Peek());
+            ts.Next();
 
             return _while;
         }
-        if (ts.GetToken().type == TokenType::Func) {
-            std::shared_ptr <AST::FunctionDefinition> function_definition = std::make_shared <AST::FunctionDefinition> ();
-            function_definition->line_begin = ts.GetToken().line_begin;
-            function_definition->position_begin = ts.GetToken().position_begin;
-            function_definition->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type == TokenType::Caret) {
+        if (ts.Check(TokenType::Func)) {
+            AST::FunctionDefinition *function_definition = AST::New <AST::FunctionDefinition> ();
+            SetBegin(function_definition, ts.Peek());
+            ts.Next();
+            if (ts.Check(TokenType::Caret)) {
                 function_definition->external = true;
-                ts.NextToken();
+                ts.Next();
             }
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier exprected in function definition", ts.GetToken());
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier exprected in function definition", ts.Peek());
             }
-            function_definition->name = ts.GetToken().value_string;
-            ts.NextToken();
-            if (ts.GetToken().type == TokenType::BracketOpen) {
-                ts.NextToken();
+            function_definition->name = ts.Peek().value;
+            ts.Next();
+            if (ts.Check(TokenType::BracketOpen)) {
+                ts.Next();
                 function_definition->metavariables = ProcessMetavariables(ts);
-                ts.NextToken();
+                ts.Next();
             }
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in function definition", ts.GetToken());
-            }
-            ts.NextToken();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in function definition");
             function_definition->signature = ProcessFunctionSignature(ts);
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::BraceOpen) {
-                throw AliasException("{ expected in function block", ts.GetToken());
+            ts.Next();
+            if (!ts.Check(TokenType::BraceOpen)) {
+                throw AliasException("{ expected in function block", ts.Peek());
             }
-            std::shared_ptr <AST::Block> _block = ProcessBlock(ts);
+            AST::Block *_block = ProcessBlock(ts);
             function_definition->body = _block;
-            function_definition->line_end = ts.GetToken().line_end;
-            function_definition->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(function_definition, ts.Peek());
+            ts.Next();
 
             return function_definition;
         }
-        if (ts.GetToken().type == TokenType::Proto) {
-            std::shared_ptr <AST::Prototype> prototype = std::make_shared <AST::Prototype> ();
-            prototype->line_begin = ts.GetToken().line_begin;
-            prototype->position_begin = ts.GetToken().position_begin;
-            prototype->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier exprected in function prototype", ts.GetToken());
-            }
-            prototype->name = ts.GetToken().value_string;
-            ts.NextToken();
-            if (ts.GetToken().type == TokenType::BracketOpen) {
-                ts.NextToken();
+        if (ts.Check(TokenType::Proto)) {
+            AST::Prototype *prototype = AST::New <AST::Prototype> ();
+            SetBegin(prototype, ts.Peek());
+            ts.Next();
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier exprected in function prototype", ts.Peek());
+            }
+            prototype->name = ts.Peek().value;
+            ts.Next();
+            if (ts.Check(TokenType::BracketOpen)) {
+                ts.Next();
                 prototype->metavariables = ProcessMetavariables(ts);
-                ts.NextToken();
-            }
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in function prototype", ts.GetToken());
+                ts.Next();
             }
-            ts.NextToken();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in function prototype");
             prototype->signature = ProcessFunctionSignature(ts);                    
-            prototype->line_end = ts.GetToken().line_end;
-            prototype->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(prototype, ts.Peek());
+            ts.Next();
 
             return prototype;
         }
-        if (ts.GetToken().type == TokenType::Def) {
-            std::shared_ptr <AST::Definition> definition = std::make_shared <AST::Definition> ();
-            definition->line_begin = ts.GetToken().line_begin;
-            definition->position_begin = ts.GetToken().position_begin;
-            definition->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier expected in definition statement", ts.GetToken());
-            }
-            definition->identifier = ts.GetToken().value_string;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Int && ts.GetToken().type != TokenType::Ptr) {
-                throw AliasException("Type expected in definition statement", ts.GetToken());
-            }
-            if (ts.GetToken().type == TokenType::Int) {
+        if (ts.Check(TokenType::Def)) {
+            AST::Definition *definition = AST::New <AST::Definition> ();
+            SetBegin(definition, ts.Peek());
+            ts.Next();
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier expected in definition statement", ts.Peek());
+            }
+            definition->identifier = ts.Peek().value;
+            ts.Next();
+            if (!ts.Check(TokenType::Int) && !ts.Check(TokenType::Ptr)) {
+                throw AliasException("Type expected in definition statement", ts.Peek());
+            }
+            if (ts.Check(TokenType::Int)) {
                 definition->type = AST::Type::Int;
             }
             else {
                 definition->type = AST::Type::Ptr;
             }
-            definition->line_end = ts.GetToken().line_end;
-            definition->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(definition, ts.Peek());
+            ts.Next();
             return definition;
         }
-        if (ts.GetToken().type == TokenType::Assume) {
-            std::shared_ptr <AST::Assumption> _assumption = std::make_shared <AST::Assumption> ();
-            _assumption->line_begin = ts.GetToken().line_begin;
-            _assumption->position_begin = ts.GetToken().position_begin;
-            _assumption->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in assume condition", ts.GetToken());
-            }
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier expected in assume condition", ts.GetToken());
-            }
-            _assumption->identifier = ts.GetToken().value_string;
-            ts.NextToken();
+        if (ts.Check(TokenType::Assume)) {
+            AST::Assumption *_assumption = AST::New <AST::Assumption> ();
+            SetBegin(_assumption, ts.Peek());
+            ts.Next();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in assume condition");
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier expected in assume condition", ts.Peek());
+            }
+            _assumption->identifier = ts.Peek().value;
+            ts.Next();
             _assumption->left = ProcessExpression(ts);
-            if (ts.GetToken().type != TokenType::Colon) {
-                throw AliasException(": expected in assume condition", ts.GetToken());
-            }
-            ts.NextToken();
+            ts.Expect(TokenType::Colon, ": expected in assume condition");
             _assumption->right = ProcessExpression(ts);
-            if (ts.GetToken().type != TokenType::ParenthesisClose) {
-                throw AliasException(") expected in assume condition", ts.GetToken());
-            }
-            ts.NextToken();
-            std::shared_ptr <AST::Statement> _statement = ProcessStatement(ts);
+            ts.Expect(TokenType::ParenthesisClose, ") expected in assume condition");
+            AST::Statement *_statement = ProcessStatement(ts);
             _assumption->statement = _statement;
             _assumption->line_end = _statement->line_end;
             _assumption->position_end = _statement->position_end;
             return _assumption;
         }
-        if (ts.GetToken().type == TokenType::Free) {
-            std::shared_ptr <AST::Free> _free = std::make_shared <AST::Free> ();
-            _free->line_begin = ts.GetToken().line_begin;
-            _free->position_begin = ts.GetToken().position_begin;
-            _free->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in free statement", ts.GetToken());
-            }
-            ts.NextToken();
-            std::shared_ptr <AST::Expression> _expression = ProcessExpression(ts);
+        if (ts.Check(TokenType::Free)) {
+            AST::Free *_free = AST::New <AST::Free> ();
+            SetBegin(_free, ts.Peek());
+            ts.Next();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in free statement");
+            AST::Expression *_expression = ProcessExpression(ts);
             _free->arg = _expression;
-            if (ts.GetToken().type != TokenType::ParenthesisClose) {
-                throw AliasException(") expected in free expression", ts.GetToken());
+            if (!ts.Check(TokenType::ParenthesisClose)) {
+                throw AliasException(") expected in free expression", ts.Peek());
             }
-            _free->line_end = ts.GetToken().line_end;
-            _free->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(_free, ts.Peek());
+            ts.Next();
             return _free;
         }
-        if (ts.GetToken().type == TokenType::Call) {
-            std::shared_ptr <AST::FunctionCall> function_call = std::make_shared <AST::FunctionCall> ();
-            function_call->line_begin = ts.GetToken().line_begin;
-            function_call->position_begin = ts.GetToken().position_begin;
-            function_call->filename = ts.GetToken().filename;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Identifier) {
-                throw AliasException("Identifier expected in function call", ts.GetToken());
-            }
-            function_call->identifier = ts.GetToken().value_string;
-            ts.NextToken();
-            if (ts.GetToken().type == TokenType::BracketOpen) {
-                ts.NextToken();
+        if (ts.Check(TokenType::Call)) {
+            AST::FunctionCall *function_call = AST::New <AST::FunctionCall> ();
+            SetBegin(function_call, ts.Peek());
+            ts.Next();
+            if (!ts.Check(TokenType::Identifier)) {
+                throw AliasException("Identifier expected in function call", ts.Peek());
+            }
+            function_call->identifier = ts.Peek().value;
+            ts.Next();
+            if (ts.Check(TokenType::BracketOpen)) {
+                ts.Next();
                 while (true) {
-                    if (ts.GetToken().type == TokenType::BracketClose) {
-                        ts.NextToken();
+                    if (ts.Check(TokenType::BracketClose)) {
+                        ts.Next();
                         break;
                     }
-                    if (ts.GetToken().type != TokenType::Identifier) {
-                        throw AliasException("Identifier expected in metavariable list", ts.GetToken());
+                    if (!ts.Check(TokenType::Identifier)) {
+                        throw AliasException("Identifier expected in metavariable list", ts.Peek());
                     }
-                    std::string _identifier = ts.GetToken().value_string;
-                    ts.NextToken();
-                    if (ts.GetToken().type != TokenType::Equal) {
-                        throw AliasException("= expected in metavariable list", ts.GetToken());
-                    }
-                    ts.NextToken();
+                    int _identifier = ts.Peek().value;
+                    ts.Next();
+                    ts.Expect(TokenType::Equal, "= expected in metavariable list");
                     function_call->metavariables.push_back({_identifier, ProcessExpression(ts)});
-                    if (ts.GetToken().type == TokenType::BracketClose) {
-                        ts.NextToken();
+                    if (ts.Check(TokenType::BracketClose)) {
+                        ts.Next();
                         break;
                     }
-                    if (ts.GetToken().type != TokenType::Comma) {
-                        throw AliasException(", expected in metavariables list", ts.GetToken());
-                    }
-                    ts.NextToken();
+                    ts.Expect(TokenType::Comma, ", expected in metavariables list");
                 }
             }
-            if (ts.GetToken().type != TokenType::ParenthesisOpen) {
-                throw AliasException("( expected in function call", ts.GetToken());
-            }
-            ts.NextToken();
+            ts.Expect(TokenType::ParenthesisOpen, "( expected in function call");
             while (true) {
-                if (ts.GetToken().type == TokenType::ParenthesisClose) {
+                if (ts.Check(TokenType::ParenthesisClose)) {
                     break;
                 }
-                if (ts.GetToken().type == TokenType::Identifier) {
-                    function_call->arguments.push_back(ts.GetToken().value_string);
+                if (ts.Check(TokenType::Identifier)) {
+                    function_call->arguments.push_back(ts.Peek().value);
                 }
                 else {
-                    throw AliasException("Identifier expected in function call", ts.GetToken());
+                    throw AliasException("Identifier expected in function call", ts.Peek());
                 }
-                ts.NextToken();
-                if (ts.GetToken().type == TokenType::ParenthesisClose) {
+                ts.Next();
+                if (ts.Check(TokenType::ParenthesisClose)) {
                     break;
                 }
-                if (ts.GetToken().type != TokenType::Comma) {
-                    throw AliasException(", expectred in function call", ts.GetToken());
-                }
-                ts.NextToken();
+                ts.Expect(TokenType::Comma, ", expectred in function call");
             }
-            function_call->line_end = ts.GetToken().line_end;
-            function_call->position_end = ts.GetToken().position_end;
-            ts.NextToken();
+            SetEnd(function_call, ts.Peek());
+            ts.Next();
             return function_call;
         }
-        if (ts.GetToken().type == TokenType::Identifier) {
-            int line_begin = ts.GetToken().line_begin;
-            int position_begin = ts.GetToken().position_begin;
-            std::string filename = ts.GetToken().filename;
-            std::string identifier = ts.GetToken().value_string;
-            ts.NextToken();
-            if (ts.GetToken().type != TokenType::Assign && ts.GetToken().type != TokenType::Move) {
-                throw AliasException(":= or <- expected in assignment or movement statement", ts.GetToken());
+        if (ts.Check(TokenType::Identifier)) {
+            const Token &op = ts.Lookahead(1);
+            if (op.type != TokenType::Assign && op.type != TokenType::Move) {
+                throw AliasException(":= or <- expected in assignment or movement statement", op);
             }
+            const Token &start = ts.Next();
 
-            if (ts.GetToken().type == TokenType::Assign) {
-                std::shared_ptr <AST::Assignment> assignment = std::make_shared <AST::Assignment> ();
-                assignment->line_begin = line_begin;
-                assignment->position_begin = position_begin;
-                assignment->filename = filename;
-                assignment->identifier = identifier;
-                ts.NextToken();
+            if (ts.Check(TokenType::Assign)) {
+                AST::Assignment *assignment = AST::New <AST::Assignment> ();
+                SetBegin(assignment, start);
+                assignment->identifier = start.value;
+                ts.Next();
                 assignment->value = ProcessExpression(ts);
                 assignment->line_end = assignment->value->line_end;
                 assignment->position_end = assignment->value->position_end;
                 return assignment;
             }
 
-            if (ts.GetToken().type == TokenType::Move) {
-                ts.NextToken();
-                if (ts.GetToken().type == TokenType::String) {
-                    std::shared_ptr <AST::MovementString> movement_string = std::make_shared <AST::MovementString> ();
-                    movement_string->line_begin = line_begin;
-                    movement_string->position_begin = position_begin;
-                    movement_string->filename = filename;
-                    movement_string->identifier = identifier;
-                    movement_string->line_end = ts.GetToken().line_end;
-                    movement_string->position_end = ts.GetToken().position_end;
-                    movement_string->value = ts.GetToken().value_string;
-                    ts.NextToken();
+            if (ts.Check(TokenType::Move)) {
+                ts.Next();
+                if (ts.Check(TokenType::String)) {
+                    AST::MovementString *movement_string = AST::New <AST::MovementString> ();
+                    SetBegin(movement_string, start);
+                    movement_string->identifier = start.value;
+                    SetEnd(movement_string, ts.Peek());
+                    movement_string->value = Symbols::Get(ts.Peek().value);
+                    ts.Next();
                     return movement_string;
                 }
                 else {
-                    std::shared_ptr <AST::Movement> movement = std::make_shared <AST::Movement> ();
-                    movement->line_begin = line_begin;
-                    movement->position_begin = position_begin;
-                    movement->filename = filename;
-                    movement->identifier = identifier;
+                    AST::Movement *movement = AST::New <AST::Movement> ();
+                    SetBegin(movement, start);
+                    movement->identifier = start.value;
                     movement->value = ProcessExpression(ts);
                     movement->line_end = movement->value->line_end;
                     movement->position_end = movement->value->position_end;
@@ -717,10 +613,18 @@ namespace Syntax {
                 }
             }
         }
-        throw AliasException("Statement expected", ts.GetToken());
+        throw AliasException("Statement expected", ts.Peek());
     }
 
-    std::shared_ptr <AST::Node> Process(const std::vector <Token> tokens) {
+    AST::Node *Process(const std::vector <Token> &tokens) {
+        // Includes that are not deferred are parsed from inside this call.
+        struct Scope {
+            const Source::File *saved = file;
+            ~Scope() {
+                file = saved;
+            }
+        } scope;
+        file = &Source::GetFile(tokens.back().file);
         TokenStream token_stream(tokens);
         return ProcessProgram(token_stream);
     }
@@ -4,35 +4,71 @@
 #include <memory>
 #include "token.h"
 #include "ast.h"
+#include "exception.h"
 
 namespace Syntax {
+    // Cursor over a token buffer owned by the caller. The buffer always ends
+    // with Eof and the cursor never moves past it, so Peek and Lookahead are
+    // safe at any position.
     class TokenStream {
     private:
-        std::vector <Token> stream;
-        int pos;
+        const Token *cursor;
+        const Token *last;
     public:
-        TokenStream(std::vector <Token> _stream) {
-            stream = _stream;
-            pos = 0;
+        TokenStream(const std::vector <Token> &_stream) {
+            cursor = _stream.data();
+            last = _stream.data() + _stream.size() - 1;
         }
 
-        Token GetToken() {
-            return stream[pos];
+        const Token &Peek() const {
+            return *cursor;
         }
 
-        void NextToken() {
-            pos++;
+        const Token &Lookahead(int k) const {
+            return (last - cursor >= k ? cursor[k] : *last);
         }
+
+        bool Check(TokenType type) const {
+            return cursor->type == type;
+        }
+
+        const Token &Next() {
+            const Token &token = *cursor;
+            if (cursor != last) {
+                cursor++;
+            }
+            return token;
+        }
+
+        const Token &Expect(TokenType type, const char *message) {
+            if (cursor->type != type) {
+                throw AliasException(message, *cursor);
+            }
+            return Next();
+        }
+    };
+
+    // An include whose statements still have to be inserted into block at
+    // index. While DeferIncludes is set on a thread, the parser records
+    // these instead of fetching the included file; Link fetches and splices
+    // them later, in source order.
+    struct Splice {
+        AST::Block *block;
+        size_t index;
+        Token token;
     };
 
-    std::shared_ptr <AST::Block> ProcessProgram(TokenStream&);
-    std::shared_ptr <AST::Block> ProcessBlock(TokenStream&);
-    std::shared_ptr <AST::Expression> ProcessExpression(TokenStream&);
-    std::shared_ptr <AST::Expression> ProcessPrimary(TokenStream&);
-    std::shared_ptr <AST::FunctionSignature> ProcessFunctionSignature(TokenStream &ts);
-    std::vector     <std::string> ProcessMetavariables(TokenStream &ts);
-    std::shared_ptr <AST::Statement> ProcessStatement(TokenStream&);
-    std::shared_ptr <AST::Node> Process(const std::vector <Token> token_stream);
+    void DeferIncludes(std::vector <Splice> *splices);
+    void Link(const std::vector <Splice> &splices);
+    void ProcessInclude(TokenStream&, AST::Block*);
+    AST::Block *ProcessProgram(TokenStream&);
+    AST::Block *ProcessBlock(TokenStream&);
+    AST::Expression *ProcessExpression(TokenStream&);
+    AST::Expression *ProcessPrimary(TokenStream&);
+    AST::FunctionSignature *ProcessFunctionSignature(TokenStream &ts);
+    std::vector     <int> ProcessMetavariables(TokenStream &ts);
+    AST::Statement *ProcessStatement(TokenStream&);
+    AST::Node *Process(const std::vector <Token> &token_stream);
 }
 
 #endif // SYNTAX_H_INCLUDED
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Expressions nested far deeper than any call stack would allow are parsed,
+# checked and compiled. Run from the repository root after building calias.
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+depth=100000
+
+python3 - "$dir" "$depth" <<'PY'
+import sys
+dir, depth = sys.argv[1], int(sys.argv[2])
+with open(dir + "/paren.al", "w") as f:
+    f.write("func ^main() {\n    def x int\n    x := " + "(" * depth + "1" + ")" * depth + "\n}\n")
+with open(dir + "/unclosed.al", "w") as f:
+    f.write("func ^main() {\n    def x int\n    x := " + "(" * depth + "1\n}\n")
+PY
+
+./calias -c "$dir/paren.al" -o "$dir/paren.asm"
+if ./calias -c "$dir/unclosed.al" -o "$dir/unclosed.asm" > "$dir/unclosed.out" 2>&1; then
+    echo "deep_nesting: unclosed parentheses accepted"
+    exit 1
+fi
+grep -q "Unexpected identifier in expression" "$dir/unclosed.out"
+echo "deep_nesting: ok"
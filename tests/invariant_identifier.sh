@@ -0,0 +1,25 @@
+#!/bin/sh
+# invariant names variables and functions anywhere but right after a while
+# condition. Run from the repository root after building calias.
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/invariant.al" <<'AL'
+func invariant(n int) {
+}
+func ^main() {
+    def invariant int
+    def p ptr
+    invariant := 3
+    p := alloc(1)
+    while (invariant) invariant (p p 0 : 0) {
+        invariant := invariant - 1
+        call invariant(invariant)
+    }
+    free(p)
+}
+AL
+
+./calias -c "$dir/invariant.al" -o "$dir/invariant.asm"
+echo "invariant_identifier: ok"
@@ -0,0 +1,33 @@
+#!/bin/sh
+# -b N lets the check of a while loop take N iterations. The loop below
+# settles in three. Run from the repository root after building calias.
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/loop.al" <<'AL'
+func ^main() {
+    def i int
+    def a ptr
+    def b ptr
+    def c ptr
+    a := alloc(4)
+    b := 0
+    c := 0
+    while (i) {
+        c := b + 0
+        b := a + 0
+    }
+    b := 0
+    c := 0
+    free(a)
+}
+AL
+
+./calias "$dir/loop.al" -b 3
+if ./calias "$dir/loop.al" -b 2 > "$dir/loop.out" 2>&1; then
+    echo "loop_budget: loop checked in fewer iterations than it takes"
+    exit 1
+fi
+grep -q "While loop check limit exceeded" "$dir/loop.out"
+echo "loop_budget: ok"
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Packets are renumbered only where that merges states, so numbering does
+# not move diagnostics, and swapped pointers of equal size are still
+# accepted. Run from the repository root after building calias.
+set -e
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/leak.al" <<'AL'
+func ^main() {
+    def p ptr
+    def q ptr
+    def i int
+    def x ptr
+    def y ptr
+    p := alloc(4)
+    q := alloc(4)
+    x := 0
+    y := 0
+    i := 0
+    if (i < 2) {
+        free(p)
+        p := alloc(4)
+        free(q)
+    }
+    free(p)
+}
+AL
+
+cat > "$dir/swap.al" <<'AL'
+func ^main() {
+    def i int
+    def p ptr
+    def q ptr
+    def t ptr
+    p := alloc(4)
+    q := alloc(4)
+    i := 0
+    while (i < 10) {
+        t := p + 0
+        p := q + 0
+        q := t + 0
+        t := 0
+        i := i + 1
+    }
+    free(p)
+    free(q)
+}
+AL
+
+if ./calias "$dir/leak.al" > "$dir/leak.out" 2>&1; then
+    echo "packet_numbering: leak accepted"
+    exit 1
+fi
+printf 'Error\n%s\n12:5-16:5\nSemantic Error: Memory leak\n' "$dir/leak.al" | diff - "$dir/leak.out"
+./calias "$dir/swap.al"
+echo "packet_numbering: ok"
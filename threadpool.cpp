@@ -0,0 +1,132 @@
+#include "threadpool.h"
+
+namespace {
+    thread_local ThreadPool *current_pool = nullptr;
+    thread_local int current_queue = 0;
+}
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    queued = 0;
+    pending = 0;
+    stop = false;
+    for (int i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique <Queue> ());
+    }
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::Size() const {
+    return (int)queues.size();
+}
+
+void ThreadPool::Submit(std::function <void()> task) {
+    int self = (current_pool == this ? current_queue : 0);
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        pending++;
+    }
+    {
+        std::lock_guard <std::mutex> lock(queues[self]->mutex);
+        queues[self]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        queued++;
+    }
+    cv.notify_one();
+}
+
+bool ThreadPool::RunOne(int self) {
+    std::function <void()> task;
+    int n = (int)queues.size();
+    for (int k = 0; k < n && !task; k++) {
+        Queue &queue = *queues[(self + k) % n];
+        std::lock_guard <std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (k == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    queued--;
+
+    ThreadPool *saved_pool = current_pool;
+    int saved_queue = current_queue;
+    current_pool = this;
+    current_queue = self;
+    task();
+    current_pool = saved_pool;
+    current_queue = saved_queue;
+
+    std::lock_guard <std::mutex> lock(mutex);
+    pending--;
+    cv.notify_all();
+    return true;
+}
+
+void ThreadPool::Work(int self) {
+    while (true) {
+        if (RunOne(self)) {
+            continue;
+        }
+        std::unique_lock <std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return stop || queued > 0; });
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::Wait() {
+    while (true) {
+        if (RunOne(0)) {
+            continue;
+        }
+        std::unique_lock <std::mutex> lock(mutex);
+        if (pending == 0) {
+            return;
+        }
+        cv.wait(lock, [this] { return pending == 0 || queued > 0; });
+    }
+}
+
+void ThreadPool::WaitUntil(std::function <bool()> done) {
+    int self = (current_pool == this ? current_queue : 0);
+    while (!done()) {
+        if (RunOne(self)) {
+            continue;
+        }
+        std::unique_lock <std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return queued > 0 || done(); });
+    }
+}
+
+void ThreadPool::Notify() {
+    std::lock_guard <std::mutex> lock(mutex);
+    cv.notify_all();
+}
@@ -0,0 +1,53 @@
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool. Every thread owns a task deque: queue 0 belongs to the
+// thread that created the pool and drains it in Wait, the others to the
+// workers. A thread takes its own newest task first and otherwise steals
+// the oldest task of another queue. Tasks submitted from inside a task go
+// to the deque of the thread running it.
+class ThreadPool {
+public:
+    ThreadPool(int threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function <void()> task);
+    // Runs tasks on the calling thread until every submitted task finished.
+    void Wait();
+    // Runs tasks on the calling thread until done holds, which can be called
+    // from inside a task. done is checked whenever a task finishes, and after
+    // Notify for changes made outside tasks.
+    void WaitUntil(std::function <bool()> done);
+    void Notify();
+    int Size() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque <std::function <void()>> tasks;
+    };
+
+    std::vector <std::unique_ptr <Queue>> queues;
+    std::vector <std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic <int> queued;
+    int pending;
+    bool stop;
+
+    bool RunOne(int self);
+    void Work(int self);
+};
+
+#endif // THREADPOOL_H_INCLUDED
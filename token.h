@@ -1,7 +1,7 @@
 #ifndef TOKEN_H_INCLUDED
 #define TOKEN_H_INCLUDED
 
-enum class TokenType {
+enum class TokenType : unsigned char {
     Identifier,
     BraceOpen,
     BraceClose,
@@ -42,40 +42,28 @@ enum class TokenType {
     Eof,
 };
 
+// Tokens are kept small since the parser copies them around freely.
+// value holds the integer for Integer tokens and the interned symbol id
+// (see symbols.h) for Identifier, String, Asm and Include tokens.
+// begin and end are offsets of the first and last character in the file,
+// Source::Locate turns them back into line and position. The file id shares
+// a word with the type, Source::AddFile refuses more files than it holds.
 class Token {
 public:
-    Token(TokenType _type, int _line_begin, int _position_begin, int _line_end, int _position_end, std::string _filename) {
+    Token(TokenType _type, int _value, int _file, unsigned int _begin, unsigned int _end) {
         type = _type;
-        line_begin = _line_begin;
-        position_begin = _position_begin;
-        line_end = _line_end;
-        position_end = _position_end;
-        filename = _filename;
-    }
-    Token(TokenType _type, int _value_int, int _line_begin, int _position_begin, int _line_end, int _position_end, std::string _filename) {
-        type = _type;
-        value_int = _value_int;
-        line_begin = _line_begin;
-        position_begin = _position_begin;
-        line_end = _line_end;
-        position_end = _position_end;
-        filename = _filename;
-    }
-    Token(TokenType _type, std::string _value_string, int _line_begin, int _position_begin, int _line_end, int _position_end, std::string _filename) {
-        type = _type;
-        value_string = _value_string;
-        line_begin = _line_begin;
-        position_begin = _position_begin;
-        line_end = _line_end;
-        position_end = _position_end;
-        filename = _filename;
+        file = _file;
+        value = _value;
+        begin = _begin;
+        end = _end;
     }
 
-    TokenType type;
-    int value_int;
-    std::string value_string;
-    int line_begin, position_begin, line_end, position_end;
-    std::string filename;
+    TokenType type : 8;
+    unsigned int file : 24;
+    int value;
+    unsigned int begin, end;
 };
 
+static_assert(sizeof(Token) == 16, "Token is expected to stay 16 bytes");
+
 #endif // TOKEN_H_INCLUDED
@@ -1,27 +1,254 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iostream>
 #include <set>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include "ast.h"
+#include "astcache.h"
 #include "validator.h"
 #include "exception.h"
+#include "linear.h"
+#include "resolve.h"
+#include "symbols.h"
+#include "settings.h"
+#include "threadpool.h"
 
 namespace AST {
 
-std::map <std::string, std::vector <std::pair <int, int>>> states_log;
+struct StatesLogEntry {
+    int line;
+    int states;
+    int merged;
+    int pruned;
+};
+
+std::map <std::string, std::vector <StatesLogEntry>> states_log;
+
+// Runs check over the states in set order. States are kept in insertion
+// order, and when a check can fail in more than one way the error of the
+// first failing state depends on the order, so a failing check is rerun over the states in
+// heap order to report the same error on every run.
+template <class Check>
+void CheckStates(const StateSet &states, Check check) {
+    try {
+        check(states);
+    }
+    catch (AliasException &) {
+        check(Sorted(states));
+        throw;
+    }
+}
 
-bool operator <(const State &a, const State &b) {
-    return a.heap < b.heap;
+// Validation threads, none when running single-threaded.
+std::unique_ptr <ThreadPool> pool;
+// Sets smaller than this are processed on the calling thread.
+const int parallel_min_states = 256;
+// Set on threads validating an instance ahead of time, and once their
+// results are no longer needed, see speculate.
+thread_local bool speculative = false;
+std::atomic <bool> cancelled(false);
+
+class Cancelled : public std::exception {
+};
+
+// Splits the states into contiguous parts, one task each, and returns the
+// part boundaries, or an empty vector if the set is processed serially.
+std::vector <int> partitionStates(const StateSet &states) {
+    states.Expand();
+    int size = states.Size();
+    if (!pool || size < parallel_min_states) {
+        return {};
+    }
+    int parts = std::min(pool->Size() * 4, size / (parallel_min_states / 4));
+    std::vector <int> bounds(parts + 1);
+    for (int k = 0; k <= parts; k++) {
+        bounds[k] = (int)((long long)size * k / parts);
+    }
+    return bounds;
 }
 
-bool operator ==(const State &a, const State &b) {
-    return a.heap == b.heap;
+// Replaces the states by the states transfer(state, result) appends to
+// result for each of them. The parts are processed in parallel and their
+// results merged in set order, so the new set and the error thrown, that of
+// the first failing state, are the same as with one thread.
+template <class Transfer>
+void transformStates(VLContext &context, Transfer transfer) {
+    StateSet _states;
+    std::vector <int> bounds = partitionStates(context.states);
+    if (bounds.empty()) {
+        std::vector <State> result;
+        for (State state : context.states) {
+            result.clear();
+            transfer(state, result);
+            for (State next : result) {
+                _states.Insert(next);
+            }
+        }
+        context.states = _states;
+        return;
+    }
+    int parts = (int)bounds.size() - 1;
+    std::vector <std::vector <State>> results(parts);
+    std::vector <std::exception_ptr> errors(parts);
+    std::atomic <int> remaining(parts);
+    for (int k = 0; k < parts; k++) {
+        pool->Submit([&, k] {
+            try {
+                for (int i = bounds[k]; i < bounds[k + 1]; i++) {
+                    transfer(context.states[i], results[k]);
+                }
+            }
+            catch (...) {
+                errors[k] = std::current_exception();
+            }
+            remaining--;
+        });
+    }
+    pool->WaitUntil([&] {
+        return remaining == 0;
+    });
+    for (int k = 0; k < parts; k++) {
+        if (errors[k]) {
+            std::rethrow_exception(errors[k]);
+        }
+    }
+    for (int k = 0; k < parts; k++) {
+        for (State next : results[k]) {
+            _states.Insert(next);
+        }
+    }
+    context.states = _states;
+}
+
+// Returns whether found holds for some state. Parts are scanned in
+// parallel, and a part stops as soon as another one found a state.
+template <class Found>
+bool anyState(const StateSet &states, Found found) {
+    std::vector <int> bounds = partitionStates(states);
+    if (bounds.empty()) {
+        for (State state : states) {
+            if (found(state)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    int parts = (int)bounds.size() - 1;
+    std::atomic <bool> done(false);
+    std::vector <std::exception_ptr> errors(parts);
+    std::atomic <int> remaining(parts);
+    for (int k = 0; k < parts; k++) {
+        pool->Submit([&, k] {
+            try {
+                for (int i = bounds[k]; i < bounds[k + 1] && !done.load(std::memory_order_relaxed); i++) {
+                    if (found(states[i])) {
+                        done = true;
+                    }
+                }
+            }
+            catch (...) {
+                errors[k] = std::current_exception();
+                done = true;
+            }
+            remaining--;
+        });
+    }
+    pool->WaitUntil([&] {
+        return remaining == 0;
+    });
+    for (int k = 0; k < parts; k++) {
+        if (errors[k]) {
+            std::rethrow_exception(errors[k]);
+        }
+    }
+    return done;
+}
+
+// With -d the states are kept in a decision diagram, see state.h. The
+// transfer functions and checks that read or write the states one slot at a
+// time then work on the diagram, and the others list the states.
+
+// Returns whether found holds for the slot of some state.
+template <class Found>
+bool anySlot(const StateSet &states, int slot, Found found) {
+    if (Settings::GetDiagrams()) {
+        for (Slot value : states.Values(slot)) {
+            if (found(value)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return anyState(states, [&](State state) {
+        return found(state[slot]);
+    });
+}
+
+// Runs check(k, value) over slot slots[k] of every state after start,
+// like CheckStates. With diagrams it runs over the distinct values of each
+// slot, and the states are listed only to report an error.
+template <class Start, class Check>
+void checkSlots(const StateSet &states, const std::vector <int> &slots, Start start, Check check) {
+    if (Settings::GetDiagrams()) {
+        try {
+            start();
+            for (int k = 0; k < (int)slots.size(); k++) {
+                for (Slot value : states.Values(slots[k])) {
+                    check(k, value);
+                }
+            }
+            return;
+        }
+        catch (AliasException &) {
+        }
+    }
+    CheckStates(states, [&](const auto &states) {
+        start();
+        for (State state : states) {
+            for (int k = 0; k < (int)slots.size(); k++) {
+                check(k, state[slots[k]]);
+            }
+        }
+    });
+}
+
+// Sets the slot of every state to value.
+void setSlot(int slot, Slot value, VLContext &context) {
+    if (Settings::GetDiagrams()) {
+        context.states = context.states.Set(slot, value);
+        return;
+    }
+    transformStates(context, [&](State state, std::vector <State> &result) {
+        result.push_back(state.Set(slot, value));
+    });
+}
+
+// Sets slot to f of slot from in every state.
+template <class F>
+void copySlot(int from, int slot, F f, VLContext &context) {
+    if (Settings::GetDiagrams()) {
+        context.states = context.states.Copy(from, slot, f);
+        return;
+    }
+    transformStates(context, [&](State state, std::vector <State> &result) {
+        result.push_back(state.Set(slot, f(state[from])));
+    });
 }
 
 bool operator <(const FunctionSignatureEvaluated &a, const FunctionSignatureEvaluated &b) {
     return a.size_in < b.size_in || (a.size_in == b.size_in && a.size_out < b.size_out);
 }
 
-int getVariableIndex(std::string id, Node *node, VLContext &context) {
+// The lookups take the index the name was resolved to, see resolve.h, and
+// search the stacks by name only if it was not.
+int getVariableIndex(int id, int variable, Node *node, VLContext &context) {
+    if (variable != -1) {
+        return variable;
+    }
     for (int i = (int)context.variable_stack.size() - 1; i >= 0; i--) {
         if (context.variable_stack[i] == id) {
             return i;
@@ -30,13 +257,31 @@ int getVariableIndex(std::string id, Node *node, VLContext &context) {
     throw AliasException("Identifier was not declared in this scope", node);
 }
 
-void checkIdentifier(std::string id, Node *node, VLContext &context) {
+// Only pointer variables have a slot in the states. Slots are numbered
+// densely in definition order, integer variables get -1.
+int getVariableSlot(int id, int variable, Node *node, VLContext &context) {
+    return context.variable_slot_stack[getVariableIndex(id, variable, node, context)];
+}
+
+int nextVariableSlot(VLContext &context) {
+    for (int i = (int)context.variable_slot_stack.size() - 1; i >= 0; i--) {
+        if (context.variable_slot_stack[i] != -1) {
+            return context.variable_slot_stack[i] + 1;
+        }
+    }
+    return 0;
+}
+
+void checkIdentifier(int id, int variable, Node *node, VLContext &context) {
+    if (variable != -1) {
+        return;
+    }
     for (int i = (int)context.variable_stack.size() - 1; i >= 0; i--) {
         if (context.variable_stack[i] == id) {
             return;
         }
     }
-    for (std::pair <std::string,int> p : context.metavariable_stack) {
+    for (std::pair <int, int> p : context.metavariable_stack) {
         if (p.first == id) {
             return;
         }
@@ -44,123 +289,264 @@ void checkIdentifier(std::string id, Node *node, VLContext &context) {
     throw AliasException("Identifier was not declared in this scope", node);
 }
 
-Type getVariableType(std::string id, Node *node, VLContext &context) {
-    for (int i = (int)context.variable_stack.size() - 1; i >= 0; i--) {
-        if (context.variable_stack[i] == id) {
-            return context.variable_type_stack[i];
-        }
-    }
-    throw AliasException("Identifier was not declared in this scope", node);
+Type getVariableType(int id, int variable, Node *node, VLContext &context) {
+    return context.variable_type_stack[getVariableIndex(id, variable, node, context)];
 }
 
-std::shared_ptr <FunctionSignature> getFunctionSignature(std::string id, Node *node, VLContext &context) {
-    for (int i = (int)context.function_stack.size() - 1; i >= 0; i--) {
-        if (context.function_stack[i] == id) {
-            return context.function_signature_stack[i];
-        }
+// Returns the index of the called function on the function stacks, or, for
+// a function found among the hidden ones, the size of the stacks plus its
+// index there.
+int getFunctionIndex(int id, int function, Node *node, VLContext &context) {
+    if (function != -1) {
+        return function;
     }
-    throw AliasException("Identifier was not declared in this scope", node);
-}
-
-int getFunctionIndex(std::string id, Node *node, VLContext &context) {
     for (int i = (int)context.function_stack.size() - 1; i >= 0; i--) {
         if (context.function_stack[i] == id) {
             return i;
         }
     }
+    for (int i = (int)context.hidden_functions.size() - 1; i >= 0; i--) {
+        const HiddenFunction &hidden = context.hidden_functions[i];
+        if (hidden.scope->function_stack[hidden.index] == id) {
+            return (int)context.function_stack.size() + i;
+        }
+    }
     throw AliasException("Identifier was not declared in this scope", node);
 }
 
-bool EvaluateExpression(std::shared_ptr <Expression> expression, VLContext context, int &result) {
-    if (auto _identifier = std::dynamic_pointer_cast <AST::Identifier> (expression)) {
-        for (std::pair <std::string,int> p : context.metavariable_stack) {
-            if (p.first == _identifier->identifier) {
-                result = p.second;
-                return true;
-            }
-        }
-        return false;
+// Offset arithmetic and comparisons of the checks. In symbolic mode a
+// comparison holds only if it does for every value of the metavariables.
+int addOffset(int a, int b, const VLContext &context) {
+    return context.symbolic ? Linear::Add(a, b) : ShiftOffset(a, b);
+}
+
+bool provenLessEqual(int a, int b, const VLContext &context) {
+    return context.symbolic ? Linear::ProvenLessEqual(a, b) : a <= b;
+}
+
+int minOffset(int a, int b, const VLContext &context) {
+    return context.symbolic ? Linear::Min(a, b) : std::min(a, b);
+}
+
+int maxOffset(int a, int b, const VLContext &context) {
+    return context.symbolic ? Linear::Max(a, b) : std::max(a, b);
+}
+
+Slot shiftSlot(Slot slot, int low, int high, const VLContext &context) {
+    return {slot.first, addOffset(slot.second, low, context), addOffset(slot.last, high, context)};
+}
+
+// A size of zero marks a free packet, so a symbolic size has to be zero or
+// positive for all values of the metavariables.
+void checkSize(int value, const VLContext &context) {
+    if (context.symbolic && value != 0 && !Linear::ProvenLessEqual(1, value)) {
+        throw Linear::Failure();
     }
-    if (auto _integer = std::dynamic_pointer_cast <AST::Integer> (expression)) {
-        result = _integer->value;
+}
+
+// Binary operations on linear values. Comparisons are known only if they
+// come out the same for every value of the metavariables.
+bool evaluateSymbolic(Kind kind, int left, int right, int &result) {
+    switch (kind) {
+    case Kind::Addition:
+        result = Linear::Add(left, right);
         return true;
-    }
-    if (auto _addition = std::dynamic_pointer_cast <AST::Addition> (expression)) {
-        int left, right;
-        bool l = EvaluateExpression(_addition->left, context, left);
-        bool r = EvaluateExpression(_addition->right, context, right);
-        if (l && r) {
-            result = left + right;
-            return true;
-        }
-        else {
+    case Kind::Subtraction:
+        result = Linear::Subtract(left, right);
+        return true;
+    case Kind::Multiplication:
+        result = Linear::Multiply(left, right);
+        return true;
+    case Kind::Division:
+        if (Linear::IsSymbolic(left) || Linear::IsSymbolic(right) || right == 0) {
             return false;
         }
-    }
-    if (auto _subtraction = std::dynamic_pointer_cast <AST::Subtraction> (expression)) {
-        int left, right;
-        bool l = EvaluateExpression(_subtraction->left, context, left);
-        bool r = EvaluateExpression(_subtraction->right, context, right);
-        if (l && r) {
-            result = left - right;
+        result = left / right;
+        return true;
+    case Kind::Less:
+        if (Linear::ProvenLessEqual(Linear::Add(left, 1), right)) {
+            result = 1;
             return true;
         }
-        else {
-            return false;
-        }
-    }
-    if (auto _multiplication = std::dynamic_pointer_cast <AST::Multiplication> (expression)) {
-        int left, right;
-        bool l = EvaluateExpression(_multiplication->left, context, left);
-        bool r = EvaluateExpression(_multiplication->right, context, right);
-        if (l && r) {
-            result = left * right;
+        if (Linear::ProvenLessEqual(right, left)) {
+            result = 0;
             return true;
         }
-        else {
-            return false;
+        return false;
+    case Kind::Equal:
+        if (left == right) {
+            result = 1;
+            return true;
         }
-    }
-    if (auto _division = std::dynamic_pointer_cast <AST::Division> (expression)) {
-        int left, right;
-        bool l = EvaluateExpression(_division->left, context, left);
-        bool r = EvaluateExpression(_division->right, context, right);
-        if (l && r) {
-            result = left / right;
+        if (Linear::ProvenLessEqual(Linear::Add(left, 1), right) || Linear::ProvenLessEqual(Linear::Add(right, 1), left)) {
+            result = 0;
             return true;
         }
-        else {
-            return false;
+        return false;
+    default:
+        return false;
+    }
+}
+
+// Metavariable values and symbolic by binding id, see VLContext. The
+// top level has binding 0.
+// The tables below are shared by the instances validated in parallel, see
+// speculate, and guarded by evaluation_mutex.
+std::map <std::pair <bool, std::vector <std::pair <int, int>>>, int> bindings = {{{false, {}}, 0}};
+std::mutex evaluation_mutex;
+
+void bindMetavariables(VLContext &context) {
+    auto key = std::make_pair(context.symbolic, context.metavariable_stack);
+    std::lock_guard <std::mutex> lock(evaluation_mutex);
+    auto it = bindings.find(key);
+    if (it == bindings.end()) {
+        it = bindings.emplace(key, (int)bindings.size()).first;
+    }
+    context.binding = it->second;
+}
+
+// Operations evaluated so far by operation and binding, with whether they
+// could be evaluated, and the counts printed with -r.
+std::map <std::pair <const Expression*, int>, std::pair <bool, int>> evaluated;
+std::atomic <long long> folded_uses(0), cached_uses(0), evaluated_nodes(0);
+
+bool EvaluateExpression(Expression *expression, const VLContext &context, int &result);
+
+bool evaluateOperation(BinaryOperation *operation, const VLContext &context, int &result) {
+    int left, right;
+    bool l = EvaluateExpression(operation->left, context, left);
+    bool r = EvaluateExpression(operation->right, context, right);
+    if (!l || !r) {
+        return false;
+    }
+    if (context.symbolic) {
+        return evaluateSymbolic(operation->kind, left, right, result);
+    }
+    switch (operation->kind) {
+    case Kind::Addition:
+        result = left + right;
+        break;
+    case Kind::Subtraction:
+        result = left - right;
+        break;
+    case Kind::Multiplication:
+        result = left * right;
+        break;
+    case Kind::Division:
+        result = left / right;
+        break;
+    case Kind::Less:
+        result = left < right;
+        break;
+    default:
+        result = left == right;
+        break;
+    }
+    return true;
+}
+
+// Constant expressions were folded by AST::Resolve. The others depend on
+// the metavariables and are evaluated once per binding.
+bool EvaluateExpression(Expression *expression, const VLContext &context, int &result) {
+    if (expression->folded) {
+        folded_uses++;
+        result = expression->folded_value;
+        return true;
+    }
+    switch (expression->kind) {
+    case Kind::Identifier: {
+        evaluated_nodes++;
+        Identifier *_identifier = static_cast <Identifier*> (expression);
+        for (std::pair <int, int> p : context.metavariable_stack) {
+            if (p.first == _identifier->identifier) {
+                result = p.second;
+                return true;
+            }
         }
+        return false;
     }
-    if (auto _less = std::dynamic_pointer_cast <AST::Less> (expression)) {
-        int left, right;
-        bool l = EvaluateExpression(_less->left, context, left);
-        bool r = EvaluateExpression(_less->right, context, right);
-        if (l && r) {
-            result = left < right;
-            return true;
+    case Kind::Integer:
+        evaluated_nodes++;
+        result = static_cast <Integer*> (expression)->value;
+        if (context.symbolic && (result <= -unbounded_offset || result >= unbounded_offset)) {
+            throw Linear::Failure();
         }
-        else {
-            return false;
+        return true;
+    case Kind::Addition:
+    case Kind::Subtraction:
+    case Kind::Multiplication:
+    case Kind::Division:
+    case Kind::Less:
+    case Kind::Equal: {
+        auto key = std::make_pair((const Expression*)expression, context.binding);
+        {
+            std::lock_guard <std::mutex> lock(evaluation_mutex);
+            auto it = evaluated.find(key);
+            if (it != evaluated.end()) {
+                cached_uses++;
+                result = it->second.second;
+                return it->second.first;
+            }
         }
+        evaluated_nodes++;
+        bool good = evaluateOperation(static_cast <BinaryOperation*> (expression), context, result);
+        std::lock_guard <std::mutex> lock(evaluation_mutex);
+        evaluated[key] = {good, good ? result : 0};
+        return good;
     }
-    if (auto _equal = std::dynamic_pointer_cast <AST::Equal> (expression)) {
-        int left, right;
-        bool l = EvaluateExpression(_equal->left, context, left);
-        bool r = EvaluateExpression(_equal->right, context, right);
-        if (l && r) {
-            result = left == right;
-            return true;
+    default:
+        return false;
+    }
+}
+
+void printLocation(const Expression *expression) {
+    std::cout << expression->Filename() << ' ' << expression->line_begin + 1 << ':' << expression->position_begin + 1 << '-' <<
+        expression->line_end + 1 << ':' << expression->position_end + 1;
+}
+
+// Lists the folded expressions, then the values of the others for each
+// concrete binding they were evaluated for, outermost expressions only.
+void PrintEvaluations() {
+    std::cout << "Constant expressions: " << folded_uses << " folded, " << cached_uses << " cached, " << evaluated_nodes << " nodes evaluated\n";
+    for (const Expression *expression : FoldedExpressions()) {
+        std::cout << "Folded ";
+        printLocation(expression);
+        std::cout << " = " << expression->folded_value << "\n";
+    }
+
+    std::lock_guard <std::mutex> lock(evaluation_mutex);
+    std::vector <const std::vector <std::pair <int, int>>*> metavariables(bindings.size());
+    for (const auto &binding : bindings) {
+        metavariables[binding.second] = binding.first.first ? nullptr : &binding.first.second;
+    }
+    std::set <std::pair <const Expression*, int>> operands;
+    for (const auto &entry : evaluated) {
+        const BinaryOperation *operation = static_cast <const BinaryOperation*> (entry.first.first);
+        operands.insert({operation->left, entry.first.second});
+        operands.insert({operation->right, entry.first.second});
+    }
+    std::vector <std::tuple <std::string, int, int, int, const Expression*, int>> values;
+    for (const auto &entry : evaluated) {
+        const Expression *expression = entry.first.first;
+        int binding = entry.first.second;
+        if (entry.second.first && metavariables[binding] && !operands.count(entry.first)) {
+            values.push_back({expression->Filename(), expression->line_begin, expression->position_begin, binding, expression, entry.second.second});
         }
-        else {
-            return false;
+    }
+    std::sort(values.begin(), values.end());
+    for (const auto &value : values) {
+        std::cout << "Evaluated ";
+        printLocation(std::get <4> (value));
+        const char *separator = " with ";
+        for (std::pair <int, int> p : *metavariables[std::get <3> (value)]) {
+            std::cout << separator << Symbols::Get(p.first) << " = " << p.second;
+            separator = ", ";
         }
+        std::cout << ": " << std::get <5> (value) << "\n";
     }
-    return false;
 }
 
-std::shared_ptr <FunctionSignatureEvaluated> EvaluateFunctionSignature(std::shared_ptr <FunctionSignature> signature, VLContext context) {
+std::shared_ptr <FunctionSignatureEvaluated> EvaluateFunctionSignature(FunctionSignature *signature, const VLContext &context) {
     std::shared_ptr <FunctionSignatureEvaluated> _signature = std::make_shared <FunctionSignatureEvaluated> ();
     _signature->identifiers = signature->identifiers;
     _signature->types = signature->types;
@@ -170,11 +556,12 @@ std::shared_ptr <FunctionSignatureEvaluated> EvaluateFunctionSignature(std::shar
             int value;
             bool good = EvaluateExpression(expr, context, value);
             if (!good) {
-                throw AliasException("Could not evaluate compile time constant", expr.get());
+                throw AliasException("Could not evaluate compile time constant", expr);
             }
-            if (value < 0) {
-                throw AliasException("Pre condition size has to be non-negative", expr.get());
+            if (!provenLessEqual(0, value, context)) {
+                throw AliasException("Pre condition size has to be non-negative", expr);
             }
+            checkSize(value, context);
             _signature->size_in.push_back(value);
         }
         else {
@@ -186,11 +573,12 @@ std::shared_ptr <FunctionSignatureEvaluated> EvaluateFunctionSignature(std::shar
             int value;
             bool good = EvaluateExpression(expr, context, value);
             if (!good) {
-                throw AliasException("Could not evaluate compile time constant", expr.get());
+                throw AliasException("Could not evaluate compile time constant", expr);
             }
-            if (value < 0) {
-                throw AliasException("Post condition size has to be non-negative", expr.get());
+            if (!provenLessEqual(0, value, context)) {
+                throw AliasException("Post condition size has to be non-negative", expr);
             }
+            checkSize(value, context);
             _signature->size_out.push_back(value);
         }
         else {
@@ -200,6 +588,283 @@ std::shared_ptr <FunctionSignatureEvaluated> EvaluateFunctionSignature(std::shar
     return _signature;
 }
 
+thread_local Canonicalizer canonicalizer;
+
+// Live packets of equal size are interchangeable: renumbering them inside a
+// state gives an equivalent state. States are renumbered canonically when
+// that merges some of them, and otherwise kept as they are, since later
+// verdicts depend on the numbering. Loop invariants compare states up to
+// numbering and renumber them always. Returns the number of merged states.
+int canonicalizeStates(VLContext &context, bool always = false) {
+    std::map <int, std::vector <int>> by_size;
+    for (int i = 0; i < (int)context.packet_size.size(); i++) {
+        if (context.packet_size[i] != 0) {
+            by_size[context.packet_size[i]].push_back(i);
+        }
+    }
+    std::vector <int> group(context.packet_size.size(), -1);
+    std::vector <std::vector <int>> members;
+    for (auto &p : by_size) {
+        if (p.second.size() > 1) {
+            for (int i : p.second) {
+                group[i] = (int)members.size();
+            }
+            members.push_back(p.second);
+        }
+    }
+    if (members.empty()) {
+        return 0;
+    }
+    canonicalizer.SetGroups(group, members);
+    // States are not kept canonical, so they would be renumbered again after
+    // every statement. A cheaper check rules out most sets that cannot merge.
+    if (!always && !canonicalizer.MayMerge(context.states)) {
+        return 0;
+    }
+    StateSet _states;
+    // Renumbering the diagram gives the same states as renumbering them
+    // one by one below, which it falls back to when it gives up.
+    if (!Settings::GetDiagrams() || !canonicalizer(context.states, _states)) {
+        bool changed = false;
+        for (State state : context.states) {
+            State canonical = canonicalizer(state);
+            changed |= canonical != state;
+            _states.Insert(canonical);
+        }
+        if (!changed) {
+            return 0;
+        }
+    }
+    int merged = context.states.Size() - _states.Size();
+    if (merged == 0 && !always) {
+        return 0;
+    }
+    context.states = _states;
+    return merged;
+}
+
+// Packet node found in slot in every state in earlier iterations of the
+// enclosing loops, or none.
+int loopPacket(Node *node, int slot, int none, VLContext &context) {
+    if (context.loop) {
+        auto it = context.loop->packets.find({node, slot});
+        if (it != context.loop->packets.end()) {
+            return it->second;
+        }
+    }
+    return none;
+}
+
+void setLoopPacket(Node *node, int slot, int packet, VLContext &context) {
+    if (context.loop) {
+        context.loop->packets[{node, slot}] = packet;
+    }
+}
+
+// With canonical numbering one packet can have different numbers in
+// different states. Before a statement that needs the packet of a slot to be
+// the same in all states, each state exchanges the packet of the slot with
+// the lowest packet the slot has in any state, if both packets are live and
+// of equal size. That does not depend on the order of the states, which
+// differs with -d. Inside a loop the packet picked in the first iteration
+// is kept.
+void alignSlot(int slot, Node *node, VLContext &context) {
+    int target = -1;
+    if (context.loop) {
+        auto it = context.loop->targets.find({node, slot});
+        if (it != context.loop->targets.end() && context.packet_size[it->second] != 0) {
+            target = it->second;
+        }
+    }
+    if (target == -1) {
+        if (Settings::GetDiagrams()) {
+            for (Slot value : context.states.Values(slot)) {
+                if (value.first >= 0) {
+                    target = value.first;
+                    break;
+                }
+            }
+        }
+        else {
+            for (State state : context.states) {
+                if (state[slot].first >= 0 && (target == -1 || state[slot].first < target)) {
+                    target = state[slot].first;
+                }
+            }
+        }
+        if (target == -1 || context.packet_size[target] == 0) {
+            return;
+        }
+        if (context.loop) {
+            context.loop->targets[{node, slot}] = target;
+        }
+    }
+    auto swapped = [&](Slot value) {
+        int packet = value.first;
+        return packet >= 0 && packet != target && context.packet_size[packet] == context.packet_size[target];
+    };
+    if (!anySlot(context.states, slot, swapped)) {
+        return;
+    }
+    if (Settings::GetDiagrams()) {
+        StateSet _states = context.states.Where(slot, [&](Slot value) {
+            return !swapped(value);
+        });
+        std::vector <int> packets;
+        for (Slot value : context.states.Values(slot)) {
+            if (swapped(value) && std::find(packets.begin(), packets.end(), value.first) == packets.end()) {
+                packets.push_back(value.first);
+            }
+        }
+        for (int packet : packets) {
+            _states.Union(context.states.Where(slot, [&](Slot value) {
+                return value.first == packet;
+            }).Swap(packet, target));
+        }
+        context.states = _states;
+        return;
+    }
+    transformStates(context, [&](State state, std::vector <State> &result) {
+        int packet = state[slot].first;
+        if (packet >= 0 && packet != target && context.packet_size[packet] == context.packet_size[target]) {
+            state = state.Swap(packet, target);
+        }
+        result.push_back(state);
+    });
+}
+
+// With a cache directory, a function validated without errors is recorded
+// in the summary cache and not validated again, in this or a later run, for
+// the same key. The key covers everything the result depends on: the tree of
+// the function, the metavariable values, its evaluated signature, and the
+// trees of the functions it calls, and of those they call, or the
+// signatures of those that are prototypes, with the settings that change
+// verdicts. Not used with -s, whose log would miss the functions found.
+std::map <Node*, uint64_t> function_hashes;
+std::mutex function_hashes_mutex;
+
+void collectCalls(Node *node, std::vector <FunctionCall*> &calls) {
+    switch (node->kind) {
+    case Kind::Block:
+        for (Statement *statement : static_cast <Block*> (node)->statement_list) {
+            collectCalls(statement, calls);
+        }
+        break;
+    case Kind::If: {
+        If *_if = static_cast <If*> (node);
+        for (std::pair <Expression*, Block*> branch : _if->branch_list) {
+            collectCalls(branch.second, calls);
+        }
+        if (_if->else_body) {
+            collectCalls(_if->else_body, calls);
+        }
+        break;
+    }
+    case Kind::While:
+        collectCalls(static_cast <While*> (node)->block, calls);
+        break;
+    case Kind::FunctionDefinition:
+        collectCalls(static_cast <FunctionDefinition*> (node)->body, calls);
+        break;
+    case Kind::Assumption:
+        collectCalls(static_cast <Assumption*> (node)->statement, calls);
+        break;
+    case Kind::FunctionCall:
+        calls.push_back(static_cast <FunctionCall*> (node));
+        break;
+    default:
+        break;
+    }
+}
+
+// Appends the hashes of the functions below visible on the stacks that the
+// body calls, directly or through them, each once. Returns false if a call
+// was left unresolved.
+bool addCallees(Node *body, size_t visible, const VLContext &context, std::set <int> &seen, std::string &key) {
+    std::vector <FunctionCall*> calls;
+    collectCalls(body, calls);
+    for (FunctionCall *call : calls) {
+        if (call->function == -1) {
+            return false;
+        }
+        if ((size_t)call->function >= visible || !seen.insert(call->function).second) {
+            continue;
+        }
+        FunctionDefinition *function = context.function_pointer_stack[call->function];
+        if (!function) {
+            key += "p" + std::to_string(ASTCache::HashSignature(context.function_signature_stack[call->function])) +
+                   " " + Symbols::Get(context.function_stack[call->function]) + " ";
+            continue;
+        }
+        uint64_t hash;
+        {
+            std::lock_guard <std::mutex> lock(function_hashes_mutex);
+            auto it = function_hashes.find(function);
+            if (it == function_hashes.end()) {
+                it = function_hashes.insert({function, ASTCache::HashNode(function)}).first;
+            }
+            hash = it->second;
+        }
+        key += "f" + std::to_string(hash) + " ";
+        if (!addCallees(function->body, call->function + 1, context, seen, key)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Computes the summary cache key of the function, the last of the visible
+// functions in context, and returns whether it has one.
+bool summaryKey(FunctionDefinition &function, const FunctionSignatureEvaluated &signature, size_t visible, const VLContext &context, uint64_t &hash) {
+    if (Settings::GetCacheDirectory().empty() || Settings::GetStates()) {
+        return false;
+    }
+    std::string key = std::to_string(Settings::GetSubsumption()) + " " + std::to_string(Settings::GetLoopBudget()) +
+                      " " + std::to_string(context.symbolic) + " ";
+    // Symbolic values are ids of this run, only the metavariables bound to
+    // themselves are known by name.
+    for (std::pair <int, int> p : context.metavariable_stack) {
+        key += Symbols::Get(p.first) + "=";
+        if (!Linear::IsSymbolic(p.second)) {
+            key += std::to_string(p.second) + " ";
+        }
+        else if (p.second == Linear::Variable(p.first)) {
+            key += "* ";
+        }
+        else {
+            return false;
+        }
+    }
+    if (!context.symbolic) {
+        for (size_t i = 0; i < signature.size_in.size(); i++) {
+            key += std::to_string(signature.size_in[i]) + ":" + std::to_string(signature.size_out[i]) + " ";
+        }
+    }
+    key += std::to_string(ASTCache::HashNode(&function)) + " ";
+    std::set <int> seen;
+    seen.insert((int)visible - 1);
+    if (!addCallees(function.body, visible, context, seen, key)) {
+        return false;
+    }
+    hash = ASTCache::Hash(key);
+    return true;
+}
+
+// Moves the functions from position from up on the stacks of context to the
+// hidden ones, keeping the stacks as they are.
+void hideFunctions(VLContext &context, size_t from) {
+    if (from == context.function_stack.size()) {
+        return;
+    }
+    std::shared_ptr <FunctionScope> scope = std::make_shared <FunctionScope> ();
+    scope->function_stack = context.function_stack;
+    scope->function_signature_stack = context.function_signature_stack;
+    scope->function_pointer_stack = context.function_pointer_stack;
+    for (size_t i = from; i < context.function_stack.size(); i++) {
+        context.hidden_functions.push_back({scope, (int)i, context.function_signature_validated[i]});
+    }
+}
+
 void ValidateFunctionDefinition(FunctionDefinition &function, VLContext &context) {
     VLContext _context = context;
     context = VLContext();
@@ -207,27 +872,43 @@ void ValidateFunctionDefinition(FunctionDefinition &function, VLContext &context
     context.function_signature_stack = _context.function_signature_stack;
     context.function_pointer_stack = _context.function_pointer_stack;
     context.function_signature_validated = _context.function_signature_validated;
+    context.hidden_functions = _context.hidden_functions;
     context.metavariable_stack = _context.metavariable_stack;
+    context.symbolic = _context.symbolic;
+    context.binding = _context.binding;
+    // The body sees the functions visible where it is defined, which are
+    // the ones up to it on the stack of the caller, as resolved. The rest of
+    // the caller's functions stay reachable by name.
+    size_t visible = context.function_pointer_stack.rend() - std::find(context.function_pointer_stack.rbegin(), context.function_pointer_stack.rend(), &function);
+    hideFunctions(context, visible);
+    context.function_stack.resize(visible);
+    context.function_signature_stack.resize(visible);
+    context.function_pointer_stack.resize(visible);
+    context.function_signature_validated.resize(visible);
 
     std::shared_ptr <FunctionSignatureEvaluated> signature = EvaluateFunctionSignature(function.signature, context);
+    uint64_t key;
+    bool summarized = summaryKey(function, *signature, visible, context, key);
+    if (summarized && ASTCache::LoadSummary(key)) {
+        context = _context;
+        return;
+    }
     int n = (int)signature->identifiers.size();
     State state;
     for (int i = 0; i < n; i++) {
         if (signature->types[i] == Type::Ptr) {
             if (signature->size_in[i] == 0)
-                state.heap.push_back({-1, 0});
+                state = state.Push({-1, 0});
             else {
-                state.heap.push_back({(int)context.packet_size.size(), 0});
+                state = state.Push({(int)context.packet_size.size(), 0});
                 context.packet_size.push_back(signature->size_in[i]);
             }
         }
-        else {
-            state.heap.push_back({-1, 0});
-        }
     }
-    context.states.insert(state);
+    context.states.Insert(state);
 
     for (int i = 0; i < n; i++) {
+        context.variable_slot_stack.push_back(signature->types[i] == Type::Ptr ? nextVariableSlot(context) : -1);
         context.variable_stack.push_back(signature->identifiers[i]);
         context.variable_type_stack.push_back(signature->types[i]);
         context.variable_is_const_stack.push_back(signature->is_const[i]);
@@ -235,31 +916,42 @@ void ValidateFunctionDefinition(FunctionDefinition &function, VLContext &context
 
     function.body->Validate(context);
 
-    std::vector <int> packet_num(n, -2);
-    for (State state : context.states) {
-        for (int i = 0; i < n; i++) {
-            if (signature->types[i] == Type::Int) continue;
-            if (signature->size_out[i] == 0) {
-                packet_num[i] = -1;
-                if (state.heap[i].first != -1) {
-                    throw AliasException("Function post condition failed", &function);
-                }
+    for (int i = 0; i < n; i++) {
+        if (signature->types[i] == Type::Ptr) {
+            alignSlot(context.variable_slot_stack[i], &function, context);
+        }
+    }
+    std::vector <int> packet_num, arguments, slots;
+    for (int i = 0; i < n; i++) {
+        if (signature->types[i] == Type::Ptr) {
+            arguments.push_back(i);
+            slots.push_back(context.variable_slot_stack[i]);
+        }
+    }
+    checkSlots(context.states, slots, [&] {
+        packet_num.assign(n, -2);
+    }, [&](int k, Slot slot) {
+        int i = arguments[k];
+        if (signature->size_out[i] == 0) {
+            packet_num[i] = -1;
+            if (slot.first != -1) {
+                throw AliasException("Function post condition failed", &function);
             }
-            else {
-                if (state.heap[i].first == -1 || 
-                    signature->is_const[i] && (context.packet_size[state.heap[i].first] - state.heap[i].second < signature->size_out[i]) ||
-                    !signature->is_const[i] && (state.heap[i].second != 0 || context.packet_size[state.heap[i].first] < signature->size_out[i])) {
-                    throw AliasException("Function post condition failed", &function);
-                }
-                if (packet_num[i] == -2) {
-                    packet_num[i] = state.heap[i].first;
-                }
-                else if (state.heap[i].first != packet_num[i]) {
-                    throw AliasException("Function post condition has several packets", &function);
-                }
+        }
+        else {
+            if (slot.first < 0 || 
+                signature->is_const[i] && !provenLessEqual(addOffset(slot.last, signature->size_out[i], context), context.packet_size[slot.first], context) ||
+                !signature->is_const[i] && (slot.second != 0 || slot.last != 0 || !provenLessEqual(signature->size_out[i], context.packet_size[slot.first], context))) {
+                throw AliasException("Function post condition failed", &function);
+            }
+            if (packet_num[i] == -2) {
+                packet_num[i] = slot.first;
+            }
+            else if (slot.first != packet_num[i]) {
+                throw AliasException("Function post condition has several packets", &function);
             }
         }
-    }
+    });
     for (int i : packet_num) {
         if (i >= 0) {
             context.packet_size[i] = 0;
@@ -271,39 +963,312 @@ void ValidateFunctionDefinition(FunctionDefinition &function, VLContext &context
         }
     }
 
+    if (summarized) {
+        ASTCache::StoreSummary(key);
+    }
     context = _context;
 }
 
+// Whether each function with metavariables could be validated once for all
+// of their values. A function counts as failed while it is validated on the
+// same thread, so a recursive one is validated per instance.
+std::map <FunctionDefinition*, bool> summaries;
+std::mutex summaries_mutex;
+thread_local std::set <FunctionDefinition*> summarizing;
+
+// Validates the function symbolically the first time it is called, and
+// returns whether that covers the call, with the metavariables bound in
+// context. Instances of a function that fails symbolically are validated
+// one by one as before, so they report the same errors.
+bool validateSymbolically(FunctionDefinition &function, VLContext &context) {
+    if (function.metavariables.empty()) {
+        return false;
+    }
+    for (int m : function.metavariables) {
+        auto it = std::find_if(context.metavariable_stack.begin(), context.metavariable_stack.end(), [&](std::pair <int, int> p) {
+            return p.first == m;
+        });
+        if (it == context.metavariable_stack.end() ||
+            !provenLessEqual(1, it->second, context) || !provenLessEqual(it->second, Linear::max_variable, context)) {
+            return false;
+        }
+    }
+    if (summarizing.count(&function)) {
+        return false;
+    }
+    {
+        std::lock_guard <std::mutex> lock(summaries_mutex);
+        auto it = summaries.find(&function);
+        if (it != summaries.end()) {
+            return it->second;
+        }
+    }
+    summarizing.insert(&function);
+    VLContext _context = context;
+    _context.symbolic = true;
+    _context.metavariable_stack.clear();
+    for (int m : function.metavariables) {
+        _context.metavariable_stack.push_back({m, Linear::Variable(m)});
+    }
+    bindMetavariables(_context);
+    // The log is only kept with -s, which also keeps other threads from
+    // validating instances ahead of time, so it is not touched otherwise.
+    std::map <std::string, std::vector <StatesLogEntry>> _states_log;
+    if (Settings::GetStates()) {
+        _states_log = states_log;
+    }
+    bool good = true;
+    try {
+        ValidateFunctionDefinition(function, _context);
+    }
+    catch (AliasException &) {
+        good = false;
+    }
+    catch (Linear::Failure &) {
+        good = false;
+    }
+    catch (...) {
+        summarizing.erase(&function);
+        throw;
+    }
+    summarizing.erase(&function);
+    if (!good && Settings::GetStates()) {
+        states_log = _states_log;
+    }
+    std::lock_guard <std::mutex> lock(summaries_mutex);
+    summaries[&function] = good;
+    return good;
+}
+
+// Validates the function for the metavariables bound in context, as a call
+// does.
+void validateInstance(FunctionDefinition &function, VLContext &context) {
+    if (validateSymbolically(function, context)) {
+        return;
+    }
+    for (std::pair <int, int> p : context.metavariable_stack) {
+        if (Linear::IsSymbolic(p.second)) {
+            throw Linear::Failure();
+        }
+    }
+    ValidateFunctionDefinition(function, context);
+}
+
+// With -j, the instances main calls with constant metavariable values, and
+// those these call in turn, are validated on the pool while main is
+// validated. The first thread to claim an instance, its task or a call that
+// reaches it first, validates it, and a call in main waits for an instance
+// claimed by a task. A call takes the result only when the instance was
+// validated without errors and validates it itself otherwise, so errors are
+// reported as with one thread. Not used with -s, which logs the states in
+// validation order.
+struct Instance {
+    enum {
+        queued,
+        running,
+        done
+    };
+    std::atomic <int> status{queued};
+    bool good = false;
+};
+
+std::map <std::pair <FunctionDefinition*, std::vector <std::pair <int, int>>>, std::unique_ptr <Instance>> instances;
+std::mutex instances_mutex;
+std::atomic <bool> speculating(false);
+// Tasks not finished yet.
+std::atomic <int> outstanding(0);
+// Instances validated by their task, and calls that took such a result,
+// printed with -r.
+std::atomic <int> instances_validated(0), instances_taken(0);
+
+Instance *findInstance(FunctionDefinition *function, const VLContext &context) {
+    if (!speculating || context.symbolic) {
+        return nullptr;
+    }
+    std::lock_guard <std::mutex> lock(instances_mutex);
+    auto it = instances.find({function, context.metavariable_stack});
+    return it == instances.end() ? nullptr : it->second.get();
+}
+
+void finishInstance(Instance &instance, bool good) {
+    instance.good = good;
+    instance.status = Instance::done;
+    pool->Notify();
+}
+
+// Validates the called function for the metavariables bound in context,
+// unless its instance was validated ahead of time.
+void validateCallee(FunctionDefinition &function, VLContext &context) {
+    Instance *instance = findInstance(&function, context);
+    if (instance) {
+        int status = Instance::queued;
+        if (instance->status.compare_exchange_strong(status, Instance::running)) {
+            try {
+                validateInstance(function, context);
+            }
+            catch (...) {
+                finishInstance(*instance, false);
+                throw;
+            }
+            finishInstance(*instance, true);
+            return;
+        }
+        // Tasks do not wait for each other, which keeps them from waiting
+        // on themselves.
+        if (status == Instance::running && !speculative) {
+            pool->WaitUntil([instance] {
+                return instance->status == Instance::done;
+            });
+        }
+        if (instance->status == Instance::done && instance->good) {
+            instances_taken++;
+            return;
+        }
+    }
+    validateInstance(function, context);
+}
+
+// Submits the instances found from main, the last function in context, and
+// returns whether it did.
+bool speculate(FunctionDefinition &main, const VLContext &context) {
+    if (!pool || Settings::GetStates()) {
+        return false;
+    }
+    cancelled = false;
+    speculating = true;
+    std::vector <std::pair <Node*, size_t>> bodies = {{main.body, context.function_pointer_stack.size()}};
+    std::set <FunctionDefinition*> scanned = {&main};
+    for (size_t b = 0; b < bodies.size(); b++) {
+        std::vector <FunctionCall*> calls;
+        collectCalls(bodies[b].first, calls);
+        for (FunctionCall *call : calls) {
+            int j = call->function;
+            if (j < 0 || (size_t)j >= bodies[b].second || !context.function_pointer_stack[j]) {
+                continue;
+            }
+            FunctionDefinition *function = context.function_pointer_stack[j];
+            std::vector <std::pair <int, int>> binding;
+            for (std::pair <int, Expression*> p : call->metavariables) {
+                if (!p.second->folded) {
+                    break;
+                }
+                binding.push_back({p.first, p.second->folded_value});
+            }
+            if (binding.size() != call->metavariables.size()) {
+                continue;
+            }
+            if (scanned.insert(function).second) {
+                bodies.push_back({function->body, (size_t)j + 1});
+            }
+
+            Instance *instance;
+            {
+                std::lock_guard <std::mutex> lock(instances_mutex);
+                std::unique_ptr <Instance> &entry = instances[{function, binding}];
+                if (entry) {
+                    continue;
+                }
+                entry = std::make_unique <Instance> ();
+                instance = entry.get();
+            }
+            VLContext _context;
+            _context.function_stack.assign(context.function_stack.begin(), context.function_stack.begin() + j + 1);
+            _context.function_signature_stack.assign(context.function_signature_stack.begin(), context.function_signature_stack.begin() + j + 1);
+            _context.function_pointer_stack.assign(context.function_pointer_stack.begin(), context.function_pointer_stack.begin() + j + 1);
+            _context.function_signature_validated.resize(j + 1);
+            _context.metavariable_stack = binding;
+            bindMetavariables(_context);
+            outstanding++;
+            pool->Submit([instance, function, _context]() mutable {
+                int status = Instance::queued;
+                if (!cancelled && instance->status.compare_exchange_strong(status, Instance::running)) {
+                    // The task can run inside another one on the same thread.
+                    bool _speculative = speculative;
+                    std::set <FunctionDefinition*> _summarizing;
+                    speculative = true;
+                    swap(summarizing, _summarizing);
+                    bool good = true;
+                    try {
+                        validateInstance(*function, _context);
+                    }
+                    catch (...) {
+                        good = false;
+                    }
+                    swap(summarizing, _summarizing);
+                    speculative = _speculative;
+                    instances_validated++;
+                    finishInstance(*instance, good);
+                }
+                outstanding--;
+            });
+        }
+    }
+    return true;
+}
+
+// Cancels the tasks still running and forgets the instances.
+void stopSpeculation() {
+    cancelled = true;
+    pool->WaitUntil([] {
+        return outstanding == 0;
+    });
+    std::lock_guard <std::mutex> lock(instances_mutex);
+    instances.clear();
+    speculating = false;
+}
+
+void PrintInstances() {
+    std::cout << "Instances: " << instances_validated << " validated ahead, " << instances_taken << " taken by calls\n";
+}
+
 void PrintStatesLog() {
     std::cout << "States" << std::endl;
     for (auto v : states_log) {
         std::cout << v.first << std::endl;
         std::cout << (int)v.second.size() << std::endl;
-        for (std::pair <int, int> p : v.second) {
-            std::cout << p.first << ":" << p.second << std::endl;
+        for (StatesLogEntry entry : v.second) {
+            std::cout << entry.line << ":" << entry.states;
+            if (entry.merged) {
+                std::cout << " (merged " << entry.merged << ")";
+            }
+            if (entry.pruned) {
+                std::cout << " (pruned " << entry.pruned << ")";
+            }
+            std::cout << std::endl;
         }
     }
 }
 
 void checkLeak(Node *node, VLContext &context) {
-    for (State state : context.states) {
-        std::vector <bool> used(context.packet_size.size());
-        for (std::pair <int,int> p : state.heap) {
-            if (p.first != -1) {
-                used[p.first] = true;
+    if (Settings::GetDiagrams()) {
+        for (int i = 0; i < (int)context.packet_size.size(); i++) {
+            if (context.packet_size[i] != 0 && context.states.Misses(i)) {
+                throw AliasException("Memory leak", node);
             }
         }
+        return;
+    }
+    bool leak = anyState(context.states, [&](State state) {
+        std::vector <bool> used(context.packet_size.size());
+        state.MarkPackets(used);
         for (int i = 0; i < (int)context.packet_size.size(); i++) {
             if (!used[i] && context.packet_size[i] != 0) {
-                throw AliasException("Memory leak", node);
+                return true;
             }
         }
+        return false;
+    });
+    if (leak) {
+        throw AliasException("Memory leak", node);
     }
 }
 
-void Validate(std::shared_ptr <Node> node) {
+void Validate(Node *node) {
+    if (Settings::GetJobs() > 1 && !pool) {
+        pool = std::make_unique <ThreadPool> (Settings::GetJobs());
+    }
     VLContext context;
-    context.states.insert(State());
+    context.states.Insert(State());
     node->Validate(context);
 }
 
@@ -312,20 +1277,37 @@ void Block::Validate(VLContext &context) {
     size_t old_function_stack_size = context.function_stack.size();
 
     for (auto i = statement_list.begin(); i != statement_list.end(); i++) {
+        if (speculative && cancelled) {
+            throw Cancelled();
+        }
         (*i)->Validate(context);
-        states_log[(*i)->filename].push_back({(*i)->line_begin + 1, (int)context.states.size()});
+        int merged = canonicalizeStates(context);
+        int pruned = 0;
+        if (Settings::GetSubsumption()) {
+            pruned = Subsume(context.states);
+        }
+        if (Settings::GetStates()) {
+            states_log[(*i)->Filename()].push_back({(*i)->line_begin + 1, context.states.Size(), merged, pruned});
+        }
     }
 
-    std::set <State> _states;
-    for (State state : context.states) {
-        for (int i = 0; i < (int)context.variable_stack.size() - old_variable_stack_size; i++) {
-            state.heap.pop_back();
+    int slots = 0;
+    for (size_t i = old_variable_stack_size; i < context.variable_stack.size(); i++) {
+        if (context.variable_slot_stack[i] != -1) {
+            slots++;
         }
-        _states.insert(state);
     }
-    context.states = _states;
+    if (Settings::GetDiagrams()) {
+        context.states = context.states.Pop(slots);
+    }
+    else {
+        transformStates(context, [&](State state, std::vector <State> &result) {
+            result.push_back(state.Pop(slots));
+        });
+    }
     checkLeak(this, context);
     while (context.variable_stack.size() > old_variable_stack_size) {
+        context.variable_slot_stack.pop_back();
         context.variable_stack.pop_back();
         context.variable_type_stack.pop_back();
         context.variable_is_const_stack.pop_back();
@@ -355,7 +1337,7 @@ void If::Validate(VLContext &context) {
     }
 
     branch_list[0].first->Validate(context);
-    std::set <State> _states = context.states;
+    StateSet _states = context.states;
     int old_cnt_packets1 = (int)context.packet_size.size();
     branch_list[0].second->Validate(context);
     int old_cnt_packets2 = (int)context.packet_size.size();
@@ -364,9 +1346,9 @@ void If::Validate(VLContext &context) {
     for (int i = old_cnt_packets1; i < old_cnt_packets2; i++)
         context.packet_size[i] = 0;
 
-    std::set <State> _states1 = context.states;
+    StateSet _states1 = context.states;
     context.states = _states;
-    std::set <State> _states2 = context.states;
+    StateSet _states2 = context.states;
     if (else_body) {
         else_body->Validate(context);
         _states2 = context.states;
@@ -375,37 +1357,203 @@ void If::Validate(VLContext &context) {
     for (int i = old_cnt_packets1; i < old_cnt_packets2; i++)
         context.packet_size[i] = _packet_size[i];
 
-    context.states.clear();
-    for (State state : _states1)
-        context.states.insert(state);
-    for (State state : _states2)
-        context.states.insert(state);
+    context.states = _states1;
+    context.states.Union(_states2);
 
     checkLeak(this, context);
 }
 
+// A state at a loop head is joined with the widest state of its shape that
+// entered the body so far, so offsets moved by the body become ranges.
+// After growing widening_delay times a range is widened to the unbounded
+// offset, so a loop walking a pointer converges in a few iterations.
+const int widening_delay = 3;
+
+// Returns whether state, replaced by its join with the states of its shape,
+// has to enter the body.
+bool enterLoop(LoopHead &head, State &state) {
+    State shape = state.Shape();
+    auto it = head.widest.find(shape);
+    if (it == head.widest.end()) {
+        head.widest.emplace(shape, std::make_pair(state, 0));
+    }
+    else {
+        State &widest = it->second.first;
+        State joined = widest.Join(state);
+        if (joined == widest) {
+            return false;
+        }
+        if (++it->second.second > widening_delay) {
+            joined = widest.Widen(joined);
+        }
+        widest = joined;
+        state = joined;
+    }
+    return head.entered.Insert(state);
+}
+
+// A loop with an invariant is validated in one pass. The states at the loop
+// head are the entry states with each pointer the invariant mentions set to
+// what it allows, after checking that it holds. The body is validated once
+// from them, and every state it gives has to be covered by a head state of
+// the same shape again.
+void validateLoopInvariant(While *loop, VLContext &context) {
+    int n_heap = (int)context.packet_size.size();
+    struct Bound {
+        int slot, base;
+        int low, high;
+    };
+    std::vector <Bound> bounds;
+    for (const InvariantClause &clause : loop->invariant) {
+        if (getVariableType(clause.identifier, -1, loop, context) != Type::Ptr) {
+            throw AliasException("Pointer variable expected in loop invariant", loop);
+        }
+        Bound bound = {getVariableSlot(clause.identifier, -1, loop, context), -1, 0, 0};
+        if (clause.low) {
+            if (getVariableType(clause.base, -1, loop, context) != Type::Ptr) {
+                throw AliasException("Pointer variable expected in loop invariant", loop);
+            }
+            bound.base = getVariableSlot(clause.base, -1, loop, context);
+            if (!EvaluateExpression(clause.low, context, bound.low)) {
+                throw AliasException("Could not evaluate compile time constant", clause.low);
+            }
+            if (!EvaluateExpression(clause.high, context, bound.high)) {
+                throw AliasException("Could not evaluate compile time constant", clause.high);
+            }
+            int low = minOffset(bound.low, bound.high, context);
+            bound.high = maxOffset(bound.low, bound.high, context);
+            bound.low = low;
+        }
+        bounds.push_back(bound);
+    }
+
+    CheckStates(context.states, [&](const auto &states) {
+        for (State state : states) {
+            for (const Bound &bound : bounds) {
+                Slot slot = state[bound.slot];
+                if (bound.base == -1) {
+                    if (slot.first != -1) {
+                        throw AliasException("Loop invariant does not hold on entry", loop);
+                    }
+                    continue;
+                }
+                Slot base = state[bound.base];
+                if (base.first < 0 || slot.first != base.first ||
+                    !provenLessEqual(addOffset(base.second, bound.low, context), slot.second, context) ||
+                    !provenLessEqual(slot.last, addOffset(base.last, bound.high, context), context)) {
+                    throw AliasException("Loop invariant does not hold on entry", loop);
+                }
+            }
+        }
+    });
+    transformStates(context, [&](State state, std::vector <State> &result) {
+        State head = state;
+        for (const Bound &bound : bounds) {
+            if (bound.base != -1) {
+                head = head.Set(bound.slot, shiftSlot(state[bound.base], bound.low, bound.high, context));
+            }
+        }
+        result.push_back(head);
+    });
+    canonicalizeStates(context, true);
+
+    // Widest head state of each shape.
+    std::map <State, State> widest;
+    for (State state : context.states) {
+        State shape = state.Shape();
+        auto it = widest.find(shape);
+        if (it == widest.end()) {
+            widest.emplace(shape, state);
+        }
+        else {
+            it->second = it->second.Join(state);
+        }
+    }
+    StateSet _states;
+    for (State state : context.states) {
+        _states.Insert(widest[state.Shape()]);
+    }
+    context.states = _states;
+
+    std::vector <int> _packet_size = context.packet_size;
+    loop->block->Validate(context);
+    if (n_heap != (int)context.packet_size.size()) {
+        throw AliasException("Inexpected allocation in while loop", loop);
+    }
+    if (context.packet_size != _packet_size) {
+        throw AliasException("Loop invariant is not preserved", loop);
+    }
+    canonicalizeStates(context, true);
+    bool broken = anyState(context.states, [&](State state) {
+        auto it = widest.find(state.Shape());
+        return it == widest.end() || it->second.Join(state) != it->second;
+    });
+    if (broken) {
+        throw AliasException("Loop invariant is not preserved", loop);
+    }
+
+    checkLeak(loop, context);
+}
+
+// The loop gives the states the body gives for the states that reach the
+// loop, and for those the body gives in turn, until no new state appears.
+// The fixpoint is found semi-naively: each iteration runs the body only on
+// the states that have not entered it yet, which gives the same states as
+// rerunning it on all of them as long as no packet is freed. An iteration
+// that frees a packet is followed by one over all states seen so far. The
+// loops nested in the outermost one share its LoopMemo, so a nested loop
+// skips the states that entered it in earlier iterations of the outer loops
+// and passes on only what the body gives for the others.
 void While::Validate(VLContext &context) {
+    if (has_invariant) {
+        validateLoopInvariant(this, context);
+        return;
+    }
     int n_heap = (int)context.packet_size.size();
+    LoopMemo memo;
+    bool outermost = !context.loop;
+    if (outermost) {
+        context.loop = &memo;
+    }
+    LoopHead &head = context.loop->heads[this];
+    StateSet delta, produced;
+    for (State state : context.states) {
+        if (enterLoop(head, state)) {
+            delta.Insert(state);
+        }
+    }
     int cnt = 0;
-    while (true) {
+    while (delta.Size() > 0) {
         cnt++;
-        if (cnt == 100) {
+        if (cnt > Settings::GetLoopBudget()) {
             throw AliasException("While loop check limit exceeded", this);
         }
-        std::set <State> _states = context.states;
+        std::vector <int> _packet_size = context.packet_size;
+        context.states = delta;
         block->Validate(context);
         if (n_heap != (int)context.packet_size.size()) {
             throw AliasException("Inexpected allocation in while loop", this);
         }
-        bool add = false;
+        produced.Union(context.states);
+        delta.Clear();
         for (State state : context.states) {
-            if (_states.find(state) == _states.end())
-                add = true;
-            _states.insert(state);
+            if (enterLoop(head, state)) {
+                delta.Insert(state);
+            }
+        }
+        if (context.packet_size != _packet_size) {
+            for (auto &p : context.loop->heads) {
+                if (p.first != this) {
+                    p.second = LoopHead();
+                }
+            }
+            delta = head.entered;
+            produced.Clear();
         }
-        if (!add)
-            break;
-        context.states = _states;
+    }
+    context.states = produced;
+    if (outermost) {
+        context.loop = nullptr;
     }
 
     checkLeak(this, context);
@@ -417,8 +1565,20 @@ void FunctionDefinition::Validate(VLContext &context) {
     context.function_pointer_stack.push_back(this);
     context.function_signature_validated.push_back({});
 
-    if (name == "main" && external) {
-        ValidateFunctionDefinition(*this, context);
+    if (Symbols::Get(name) == "main" && external) {
+        bool speculated = speculate(*this, context);
+        try {
+            ValidateFunctionDefinition(*this, context);
+        }
+        catch (...) {
+            if (speculated) {
+                stopSpeculation();
+            }
+            throw;
+        }
+        if (speculated) {
+            stopSpeculation();
+        }
     }
 }
 
@@ -430,81 +1590,69 @@ void Prototype::Validate(VLContext &context) {
 }
 
 void Definition::Validate(VLContext &context) {
+    context.variable_slot_stack.push_back(type == Type::Ptr ? nextVariableSlot(context) : -1);
     context.variable_stack.push_back(identifier);
     context.variable_type_stack.push_back(type);
     context.variable_is_const_stack.push_back(false);
+    if (type != Type::Ptr) {
+        return;
+    }
 
-    std::set <State> _states;
-    for (State state : context.states) {
-        state.heap.push_back({-1, 0});
-        _states.insert(state);
+    if (Settings::GetDiagrams()) {
+        context.states = context.states.Push({-1, 0});
+        return;
     }
-    context.states = _states;
+    transformStates(context, [&](State state, std::vector <State> &result) {
+        result.push_back(state.Push({-1, 0}));
+    });
 }
 
 void Assignment::Validate(VLContext &context) {
-    int index = getVariableIndex(identifier, this, context);
+    int index = getVariableIndex(identifier, variable, this, context);
     if (context.variable_is_const_stack[index]) {
         throw AliasException("Const values can not be changed", this);
     }
-    if (getVariableType(identifier, this, context) == Type::Ptr) {
-        if (auto _alloc = std::dynamic_pointer_cast <AST::Alloc> (value)) {
-            std::set <State> _states;
-            for (State state : context.states) {
-                state.heap[index] = {(int)context.packet_size.size(), 0};
-                _states.insert(state);
-            }
-            context.states = _states;
+    if (getVariableType(identifier, variable, this, context) == Type::Ptr) {
+        int slot = context.variable_slot_stack[index];
+        if (auto _alloc = AST::As <AST::Alloc> (value)) {
+            int packet = (int)context.packet_size.size();
+            setSlot(slot, {packet, 0}, context);
             int value;
             bool good = EvaluateExpression(_alloc->expression, context, value);
             if (!good) {
-                throw AliasException("Could not evaluate compile time constant", _alloc->expression.get());
+                throw AliasException("Could not evaluate compile time constant", _alloc->expression);
             }
-            if (value < 0) {
-                throw AliasException("Alloc size has to be non negative", _alloc->expression.get());
+            if (!provenLessEqual(0, value, context)) {
+                throw AliasException("Alloc size has to be non negative", _alloc->expression);
             }
+            checkSize(value, context);
             context.packet_size.push_back(value);
         }
-        else if (auto _addition = std::dynamic_pointer_cast <AST::Addition> (value)) {
-            auto _identifier = std::dynamic_pointer_cast <AST::Identifier> (_addition->left);
+        else if (auto _addition = AST::As <AST::Addition> (value)) {
+            auto _identifier = AST::As <AST::Identifier> (_addition->left);
             if (!_identifier) {
                 throw AliasException("Identifier expected in left part of addition in right part of assignment", this);
             }
             int value;
             bool good = EvaluateExpression(_addition->right, context, value);
             if (!good) {
-                throw AliasException("Could not evaluate compile time constant", _addition->right.get());
-            }
-            if (getVariableType(_identifier->identifier, this, context) == Type::Ptr) {
-                int index2 = getVariableIndex(_identifier->identifier, this, context);
-                std::set <State> _states;
-                for (State state : context.states) {
-                    if (state.heap[index2].first == -1) {
-                        state.heap[index] = {-1, 0};
-                    }
-                    else {
-                        state.heap[index] = {state.heap[index2].first, state.heap[index2].second + value};
+                throw AliasException("Could not evaluate compile time constant", _addition->right);
+            }
+            if (getVariableType(_identifier->identifier, _identifier->variable, this, context) == Type::Ptr) {
+                int slot2 = getVariableSlot(_identifier->identifier, _identifier->variable, this, context);
+                copySlot(slot2, slot, [&](Slot from) {
+                    if (from.first == -1) {
+                        return Slot(-1, 0);
                     }
-                    _states.insert(state);
-                }
-                context.states = _states;
+                    return shiftSlot(from, value, value, context);
+                }, context);
             }
             else {
-                std::set <State> _states;
-                for (State state : context.states) {
-                    state.heap[index] = {-1, 0};
-                    _states.insert(state);
-                }
-                context.states = _states;
+                setSlot(slot, {-1, 0}, context);
             }
         }
         else {
-            std::set <State> _states;
-            for (State state : context.states) {
-                state.heap[index] = {-1, 0};
-                _states.insert(state);
-            }
-            context.states = _states;
+            setSlot(slot, {-1, 0}, context);
         }
         checkLeak(this, context);
     }
@@ -514,14 +1662,15 @@ void Assignment::Validate(VLContext &context) {
 }
 
 void Movement::Validate(VLContext &context) {
-    if (getVariableType(identifier, this, context) == Type::Ptr) {
-        int index = getVariableIndex(identifier, this, context);
-        for (State state : context.states) {
-            if (state.heap[index].first == -1 ||
-                state.heap[index].second < 0 ||
-                state.heap[index].second >= context.packet_size[state.heap[index].first]) {
-                throw AliasException("Access violation", this);
-            }
+    if (getVariableType(identifier, variable, this, context) == Type::Ptr) {
+        int slot = getVariableSlot(identifier, variable, this, context);
+        bool violation = anySlot(context.states, slot, [&](Slot value) {
+            return value.first < 0 ||
+                !provenLessEqual(0, value.second, context) ||
+                !provenLessEqual(addOffset(value.last, 1, context), context.packet_size[value.first], context);
+        });
+        if (violation) {
+            throw AliasException("Access violation", this);
         }
     }
     else {
@@ -531,15 +1680,16 @@ void Movement::Validate(VLContext &context) {
 }
 
 void MovementString::Validate(VLContext &context) {
-    if (getVariableType(identifier, this, context) == Type::Ptr) {
-        int index = getVariableIndex(identifier, this, context);
+    if (getVariableType(identifier, variable, this, context) == Type::Ptr) {
+        int slot = getVariableSlot(identifier, variable, this, context);
         int length = ((int)value.size() + 3) / 4;
-        for (State state : context.states) {
-            if (state.heap[index].first == -1 ||
-                state.heap[index].second < 0 ||
-                state.heap[index].second + length - 1 >= context.packet_size[state.heap[index].first]) {
-                throw AliasException("Access violation", this);
-            }
+        bool violation = anySlot(context.states, slot, [&](Slot value) {
+            return value.first < 0 ||
+                !provenLessEqual(0, value.second, context) ||
+                !provenLessEqual(addOffset(value.last, length, context), context.packet_size[value.first], context);
+        });
+        if (violation) {
+            throw AliasException("Access violation", this);
         }
     }
     else {
@@ -548,55 +1698,53 @@ void MovementString::Validate(VLContext &context) {
 }
 
 void Assumption::Validate(VLContext &context) {
-    if (auto _assignment = std::dynamic_pointer_cast <AST::Assignment> (statement)) {
-        std::string identifier1 = _assignment->identifier;
-        if (auto _addition = std::dynamic_pointer_cast <AST::Addition> (_assignment->value)) {
-            auto _identifier2 = std::dynamic_pointer_cast <AST::Identifier> (_addition->left);
-            auto _identifier3 = std::dynamic_pointer_cast <AST::Identifier> (_addition->right);
-            if (getVariableType(identifier, this, context) == Type::Ptr) {
+    if (auto _assignment = AST::As <AST::Assignment> (statement)) {
+        int identifier1 = _assignment->identifier;
+        if (auto _addition = AST::As <AST::Addition> (_assignment->value)) {
+            auto _identifier2 = AST::As <AST::Identifier> (_addition->left);
+            auto _identifier3 = AST::As <AST::Identifier> (_addition->right);
+            if (getVariableType(identifier, variable, this, context) == Type::Ptr) {
                 throw AliasException("Integer variable expected in assumption", this);
             }
-            if (getVariableType(identifier1, this, context) == Type::Int) {
+            if (getVariableType(identifier1, _assignment->variable, this, context) == Type::Int) {
                 throw AliasException("Pointer variable expected in left part of assignment", this);
             }
-            if (!_identifier2 || getVariableType(_identifier2->identifier, this, context) == Type::Int) {
+            if (!_identifier2 || getVariableType(_identifier2->identifier, _identifier2->variable, this, context) == Type::Int) {
                 throw AliasException("Pointer variable expected in left part of addition in right part of assignment", this);
             }
-            if (!_identifier3 || getVariableType(_identifier3->identifier, this, context) == Type::Ptr) {
+            if (!_identifier3 || getVariableType(_identifier3->identifier, _identifier3->variable, this, context) == Type::Ptr) {
                 throw AliasException("Integer variable expected in right part of addition in right part of assignment", this);
             }
-            std::string identifier2 = _identifier2->identifier;
-            std::string identifier3 = _identifier3->identifier;
+            int identifier2 = _identifier2->identifier;
+            int identifier3 = _identifier3->identifier;
             if (identifier != identifier3) {
                 throw AliasException("Right part of addition in right part of assumption is not defined", this);
             }
 
-            int index1 = getVariableIndex(identifier1, this, context);
-            int index2 = getVariableIndex(identifier2, this, context);
-            std::set <State> _states;
-            for (State state : context.states) {
-                if (state.heap[index2].first == -1) {
-                    state.heap[index1] = {-1, 0};
-                    _states.insert(state);
+            int slot1 = getVariableSlot(identifier1, _assignment->variable, this, context);
+            int slot2 = getVariableSlot(identifier2, _identifier2->variable, this, context);
+            // The bounds do not depend on the state, so they are evaluated
+            // once, if some state needs them.
+            int left_value = 0, right_value = 0, low = 0, high = 0;
+            bool needed = anySlot(context.states, slot2, [&](Slot value) {
+                return value.first != -1;
+            });
+            if (needed) {
+                if (!EvaluateExpression(left, context, left_value)) {
+                    throw AliasException("Could not evaluate compile time constant", left);
                 }
-                else {
-                    int value;
-                    bool good = EvaluateExpression(left, context, value);
-                    if (!good) {
-                        throw AliasException("Could not evaluate compile time constant", left.get());
-                    }
-                    state.heap[index1] = {state.heap[index2].first, state.heap[index2].second + value};
-                    _states.insert(state);
-
-                    good = EvaluateExpression(right, context, value);
-                    if (!good) {
-                        throw AliasException("Could not evaluate compile time constant", right.get());
-                    }
-                    state.heap[index1] = {state.heap[index2].first, state.heap[index2].second + value};
-                    _states.insert(state);
+                if (!EvaluateExpression(right, context, right_value)) {
+                    throw AliasException("Could not evaluate compile time constant", right);
                 }
+                low = minOffset(left_value, right_value, context);
+                high = maxOffset(left_value, right_value, context);
             }
-            context.states = _states;
+            copySlot(slot2, slot1, [&](Slot from) {
+                if (from.first == -1) {
+                    return Slot(-1, 0);
+                }
+                return shiftSlot(from, low, high, context);
+            }, context);
         }
         else {
             throw AliasException("Addition expected in right part of assignment", this);
@@ -608,7 +1756,7 @@ void Assumption::Validate(VLContext &context) {
 }
 
 void Identifier::Validate(VLContext &context) {
-    checkIdentifier(identifier, this, context);
+    checkIdentifier(identifier, variable, this, context);
 }
 
 void Integer::Validate(VLContext &context) {
@@ -619,34 +1767,42 @@ void Alloc::Validate(VLContext &context) {
 }
 
 void Free::Validate(VLContext &context) {
-    if (auto _identifier = std::dynamic_pointer_cast <AST::Identifier> (arg)) {
-        int index = getVariableIndex(_identifier->identifier, this, context);
+    if (auto _identifier = AST::As <AST::Identifier> (arg)) {
+        int index = getVariableIndex(_identifier->identifier, _identifier->variable, this, context);
         if (context.variable_is_const_stack[index]) {
             throw AliasException("Const values can not be changed", this);
         }
-        int packet_id = -1;
-        for (State state : context.states) {
-            if (state.heap[index].first == -1 || state.heap[index].second != 0) {
+        int slot = context.variable_slot_stack[index];
+        if (slot == -1) {
+            throw AliasException("Access violation", this);
+        }
+        alignSlot(slot, this, context);
+        int packet_id;
+        checkSlots(context.states, {slot}, [&] {
+            packet_id = loopPacket(this, slot, -1, context);
+        }, [&](int, Slot value) {
+            if (value.first < 0 || value.second != 0 || value.last != 0) {
                 throw AliasException("Access violation", this);
             }
             if (packet_id == -1) {
-                packet_id = state.heap[index].first;
+                packet_id = value.first;
             }
-            if (packet_id != state.heap[index].first) {
+            if (packet_id != value.first) {
                 throw AliasException("Unpredictible free", this);
             }
+        });
+        if (packet_id == -1) {
+            return;
         }
+        setLoopPacket(this, slot, packet_id, context);
         context.packet_size[packet_id] = 0;
-        std::set <State> _states;
-        for (State state : context.states) {
-            for (int i = 0; i < (int)state.heap.size(); i++) {
-                if (state.heap[i].first == packet_id) {
-                    state.heap[i] = {-1, 0};
-                }
-            }
-            _states.insert(state);
+        if (Settings::GetDiagrams()) {
+            context.states = context.states.ClearPacket(packet_id, -1);
+            return;
         }
-        context.states = _states;
+        transformStates(context, [&](State state, std::vector <State> &result) {
+            result.push_back(state.ClearPacket(packet_id, -1));
+        });
     }
     else {
         throw AliasException("Identifier expected in free statement", this);
@@ -654,30 +1810,57 @@ void Free::Validate(VLContext &context) {
 }
 
 void FunctionCall::Validate(VLContext &context) {
-    std::shared_ptr <FunctionSignature> _signature = getFunctionSignature(identifier, this, context);
-
-    std::vector <std::pair <std::string, int>> metavariable_stack;
-    for (std::pair <std::string, std::shared_ptr <Expression>> p : metavariables) {
+    int index = getFunctionIndex(identifier, function, this, context);
+    int hidden = index - (int)context.function_stack.size();
+    FunctionSignature *_signature = hidden < 0 ? context.function_signature_stack[index] :
+        context.hidden_functions[hidden].scope->function_signature_stack[context.hidden_functions[hidden].index];
+    // Looked up again after validating the callee, which replaces the stacks.
+    auto validated = [&]() -> std::set <FunctionSignatureEvaluated>& {
+        return hidden < 0 ? context.function_signature_validated[index] : context.hidden_functions[hidden].validated;
+    };
+
+    std::vector <std::pair <int, int>> metavariable_stack;
+    for (std::pair <int, Expression*> p : metavariables) {
         int value;
         bool good = EvaluateExpression(p.second, context, value);
         if (!good) {
-            throw AliasException("Could not evaluate compile time constant", p.second.get());
+            throw AliasException("Could not evaluate compile time constant", p.second);
         }
         metavariable_stack.push_back({p.first, value});
     }
     swap(context.metavariable_stack, metavariable_stack);
+    int binding = context.binding;
+    bindMetavariables(context);
 
     std::shared_ptr <FunctionSignatureEvaluated> signature = EvaluateFunctionSignature(_signature, context);
 
-    int index = getFunctionIndex(identifier, this, context);
-    if (context.function_signature_validated[index].find(*signature.get()) == context.function_signature_validated[index].end()){
-        if(context.function_pointer_stack[index]) {
-            ValidateFunctionDefinition(*context.function_pointer_stack[index], context);
+    if (validated().find(*signature) == validated().end()){
+        if (hidden < 0) {
+            FunctionDefinition *function = context.function_pointer_stack[index];
+            if (function) {
+                validateCallee(*function, context);
+            }
         }
-        context.function_signature_validated[index].insert(*signature.get());
+        else {
+            // The callee sees its own scope, and the functions of the
+            // caller stay reachable by name.
+            const HiddenFunction &callee = context.hidden_functions[hidden];
+            FunctionDefinition *function = callee.scope->function_pointer_stack[callee.index];
+            if (function) {
+                VLContext _context = context;
+                hideFunctions(_context, 0);
+                _context.function_stack.assign(callee.scope->function_stack.begin(), callee.scope->function_stack.begin() + callee.index + 1);
+                _context.function_signature_stack.assign(callee.scope->function_signature_stack.begin(), callee.scope->function_signature_stack.begin() + callee.index + 1);
+                _context.function_pointer_stack.assign(callee.scope->function_pointer_stack.begin(), callee.scope->function_pointer_stack.begin() + callee.index + 1);
+                _context.function_signature_validated.assign(callee.index + 1, {});
+                validateCallee(*function, _context);
+            }
+        }
+        validated().insert(*signature);
     }
 
     context.metavariable_stack = metavariable_stack;
+    context.binding = binding;
 
     if (signature->identifiers.size() != arguments.size()) {
         throw AliasException("Incorrect number of arguments in function call", this);
@@ -687,32 +1870,36 @@ void FunctionCall::Validate(VLContext &context) {
     std::vector <int> packet_num(n, -2);
 
     for (int i = 0; i < n; i++) {
-        if (signature->types[i] != getVariableType(arguments[i], this, context)) {
+        if (signature->types[i] != getVariableType(arguments[i], argument_variables[i], this, context)) {
             throw AliasException("Incorrect type of argument in function call", this);
         }
         if (signature->types[i] == AST::Type::Ptr) {
-            int index = getVariableIndex(arguments[i], this, context);
-            for (State state : context.states) {
+            int index = getVariableSlot(arguments[i], argument_variables[i], this, context);
+            alignSlot(index, this, context);
+            checkSlots(context.states, {index}, [&] {
+                packet_num[i] = loopPacket(this, index, -2, context);
+            }, [&](int, Slot slot) {
                 if (signature->size_in[i] == 0) {
                     packet_num[i] = -1;
-                    if (state.heap[index].first != -1) {
+                    if (slot.first != -1) {
                         throw AliasException("Function pre condition failed", this);
                     }
                 }
                 else {
-                    if (state.heap[index].first == -1 || 
-                        signature->is_const[i] && (context.packet_size[state.heap[index].first] - state.heap[index].second < signature->size_in[i]) ||
-                        !signature->is_const[i] && (state.heap[index].second != 0 || context.packet_size[state.heap[index].first] < signature->size_in[i])) {
+                    if (slot.first < 0 || 
+                        signature->is_const[i] && !provenLessEqual(addOffset(slot.last, signature->size_in[i], context), context.packet_size[slot.first], context) ||
+                        !signature->is_const[i] && (slot.second != 0 || slot.last != 0 || !provenLessEqual(signature->size_in[i], context.packet_size[slot.first], context))) {
                         throw AliasException("Function pre condition failed", this);
                     }
                     if (packet_num[i] == -2) {
-                        packet_num[i] = state.heap[index].first;
+                        packet_num[i] = slot.first;
                     }
-                    else if (state.heap[index].first != packet_num[i]) {
+                    else if (slot.first != packet_num[i]) {
                         throw AliasException("Function pre condition has several packets", this);
                     }
                 }
-            }
+            });
+            setLoopPacket(this, index, packet_num[i], context);
         }
     }
 
@@ -727,39 +1914,53 @@ void FunctionCall::Validate(VLContext &context) {
         }
     }
 
-    std::set <State> _states;
-    for (State state : context.states) {
+    std::vector <int> slots(n, -1);
+    for (int i = 0; i < n; i++) {
+        if (signature->types[i] == Type::Ptr && !signature->is_const[i]) {
+            slots[i] = getVariableSlot(arguments[i], argument_variables[i], this, context);
+        }
+    }
+    if (Settings::GetDiagrams()) {
         for (int i = 0; i < n; i++) {
             if (signature->types[i] == Type::Ptr && !signature->is_const[i]) {
-                int index = getVariableIndex(arguments[i], this, context);
-                for (int j = 0; j < (int)state.heap.size(); j++) {
-                    if (j != index && packet_num[i] >= 0 && state.heap[j].first == packet_num[i]) {
-                        state.heap[j] = {-1, 0};
-                    }
+                if (packet_num[i] >= 0) {
+                    context.states = context.states.ClearPacket(packet_num[i], slots[i]);
+                }
+                context.states = context.states.Set(slots[i], signature->size_out[i] == 0 ? Slot(-1, 0) : Slot(new_packet[i], 0));
+            }
+        }
+        return;
+    }
+    transformStates(context, [&](State state, std::vector <State> &result) {
+        for (int i = 0; i < n; i++) {
+            if (signature->types[i] == Type::Ptr && !signature->is_const[i]) {
+                int index = slots[i];
+                if (packet_num[i] >= 0) {
+                    state = state.ClearPacket(packet_num[i], index);
                 }
                 if (signature->size_out[i] == 0) {
-                    state.heap[i] = {-1, 0};
+                    state = state.Set(index, {-1, 0});
                 }
                 else {
-                    state.heap[index] = {new_packet[i], 0};
+                    state = state.Set(index, {new_packet[i], 0});
                 }
             }
         }
-        _states.insert(state);
-    }
-    context.states = _states;
+        result.push_back(state);
+    });
 }
 
 void Dereference::Validate(VLContext &context) {
-    if (auto _identifier = std::dynamic_pointer_cast <AST::Identifier> (arg)) {
-        if (getVariableType(_identifier->identifier, this, context) == Type::Ptr) {
-            int index = getVariableIndex(_identifier->identifier, this, context);
-            for (State state : context.states) {
-                if (state.heap[index].first == -1 ||
-                    state.heap[index].second < 0 ||
-                    state.heap[index].second >= context.packet_size[state.heap[index].first]) {
-                    throw AliasException("Access violation", this);
-                }
+    if (auto _identifier = AST::As <AST::Identifier> (arg)) {
+        if (getVariableType(_identifier->identifier, _identifier->variable, this, context) == Type::Ptr) {
+            int slot = getVariableSlot(_identifier->identifier, _identifier->variable, this, context);
+            bool violation = anySlot(context.states, slot, [&](Slot value) {
+                return value.first < 0 ||
+                    !provenLessEqual(0, value.second, context) ||
+                    !provenLessEqual(addOffset(value.last, 1, context), context.packet_size[value.first], context);
+            });
+            if (violation) {
+                throw AliasException("Access violation", this);
             }
         }
         else {
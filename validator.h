@@ -5,8 +5,10 @@
 #include "ast.h"
 
 namespace AST {
-    void Validate(std::shared_ptr <Node> node);
+    void Validate(Node *node);
     void PrintStatesLog();
+    void PrintEvaluations();
+    void PrintInstances();
 }
 
 #endif // VALIDATOR_H_INCLUDED